@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "xtimer.h"
+
+#include "errors.h"
+#include "fifo.h"
+
+// compares the RX path of modem_interface.c on fifo_t and on fifo_pow2_t: the ISR puts the bytes one by one, the
+// RX thread peeks the header, skips it and reads the payload through a subview. Run it with "make all term" (BOARD=native
+// by default), the timings of native depend on the host so only compare the two results of the same run.
+
+#define BUFFER_SIZE 256
+#define HEADER_SIZE 7
+#define PAYLOAD_SIZE 40
+#define FRAMES 20000
+
+static uint8_t buffer[BUFFER_SIZE];
+static uint8_t frame[HEADER_SIZE + PAYLOAD_SIZE];
+static volatile uint32_t checksum; // keeps the reads from being optimized away
+
+static uint32_t sum(fifo_t* payload_fifo)
+{
+    uint8_t payload[PAYLOAD_SIZE];
+    fifo_peek(payload_fifo, payload, 0, PAYLOAD_SIZE);
+    uint32_t result = 0;
+    for(int i = 0; i < PAYLOAD_SIZE; i++)
+        result += payload[i];
+
+    return result;
+}
+
+static uint32_t bench_fifo(void)
+{
+    fifo_t fifo;
+    fifo_init(&fifo, buffer, sizeof(buffer));
+    uint8_t header[HEADER_SIZE];
+    uint32_t start = xtimer_now_usec();
+    for(int i = 0; i < FRAMES; i++) {
+        for(unsigned j = 0; j < sizeof(frame); j++)
+            fifo_put_byte(&fifo, frame[j]);
+
+        fifo_peek(&fifo, header, 0, HEADER_SIZE);
+        fifo_skip(&fifo, HEADER_SIZE);
+        fifo_t payload_fifo;
+        fifo_init_subview(&payload_fifo, &fifo, 0, PAYLOAD_SIZE);
+        checksum += sum(&payload_fifo);
+        fifo_skip(&fifo, PAYLOAD_SIZE);
+    }
+
+    return xtimer_now_usec() - start;
+}
+
+static uint32_t bench_fifo_pow2(void)
+{
+    fifo_pow2_t fifo;
+    fifo_pow2_init(&fifo, buffer, sizeof(buffer));
+    uint8_t header[HEADER_SIZE];
+    uint32_t start = xtimer_now_usec();
+    for(int i = 0; i < FRAMES; i++) {
+        for(unsigned j = 0; j < sizeof(frame); j++)
+            fifo_pow2_put_byte(&fifo, frame[j]);
+
+        fifo_pow2_peek(&fifo, header, 0, HEADER_SIZE);
+        fifo_pow2_skip(&fifo, HEADER_SIZE);
+        fifo_t payload_fifo;
+        fifo_pow2_init_subview(&payload_fifo, &fifo, 0, PAYLOAD_SIZE);
+        checksum += sum(&payload_fifo);
+        fifo_pow2_skip(&fifo, PAYLOAD_SIZE);
+    }
+
+    return xtimer_now_usec() - start;
+}
+
+int main(void)
+{
+    for(unsigned i = 0; i < sizeof(frame); i++)
+        frame[i] = i;
+
+    uint32_t bytes = (uint32_t)FRAMES * sizeof(frame);
+    uint32_t fifo_us = bench_fifo();
+    uint32_t pow2_us = bench_fifo_pow2();
+    printf("fifo_t:      %lu bytes in %lu us\n", (unsigned long)bytes, (unsigned long)fifo_us);
+    printf("fifo_pow2_t: %lu bytes in %lu us\n", (unsigned long)bytes, (unsigned long)pow2_us);
+    return 0;
+}
@@ -1,6 +1,7 @@
 /*
 This example shows how to use the modem API to interface with a serial OSS-7 modem.
-An unsolicited message will be transmitted periodically using the DASH7 interface or the LoRaWAN interface (alternating)
+An unsolicited message will be transmitted periodically using the DASH7 interface or the LoRaWAN interface (alternating).
+The samples are batched and compressed (see sample_codec.h), the backend can decode the frames using sample_codec_decode().
 */
 
 #include <stdio.h>
@@ -15,12 +16,23 @@ An unsolicited message will be transmitted periodically using the DASH7 interfac
 #include "modem.h"
 
 #define INTERVAL (20U * US_PER_SEC)
+// one uplink every 10 samples, or every 5 minutes at most
+#define BATCH_MAX_SAMPLES 10
+#define BATCH_MAX_AGE_MS (5U * 60U * MS_PER_SEC)
+// the modem is reinitialized when it did not respond for 3 minutes
+#define WATCHDOG_INTERVAL_MS (60U * MS_PER_SEC)
+#define WATCHDOG_MAX_MISSES 3
 
 #define LORAWAN_NETW_SESSION_KEY  { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }
 #define LORAWAN_APP_SESSION_KEY  { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }
 #define LORAWAN_DEV_ADDR 0x00000000
 #define LORAWAN_NETW_ID 0x000000
 
+// user files on the modem, which should be allocated by the modem firmware
+#define SENSOR_FILE_ID 0x40
+#define ALP_CMD_FILE_ID 0x41
+#define INTERFACE_FILE_ID 0x42
+
 void on_modem_command_completed_callback(bool with_error)
 {
     printf("modem command completed (success = %i)\n", !with_error);
@@ -36,6 +48,22 @@ void on_modem_write_file_data_callback(uint8_t file_id, uint32_t offset, uint32_
     printf("modem write file data file %i offset %li size %li buffer %p\n", file_id, offset, size, output_buffer);
 }
 
+void on_modem_health_callback(bool alive)
+{
+    printf("modem %s\n", alive ? "alive" : "not responding, reinitialized");
+}
+
+// with the action protocol every file write is pushed by the modem itself. An expired frame is flushed from the dispatch
+// worker, so the write is async, its completion is reported by on_modem_command_completed_callback()
+static bool write_sensor_file(uint8_t file_id, uint8_t* frame, uint8_t length)
+{
+    modem_status_t status = modem_write_file_async(file_id, 0, length, frame);
+    printf("Write started with status %i\n", status);
+    return status == MODEM_STATUS_COMMAND_PROCESSING;
+}
+
+static modem_sample_batch_t sample_batch;
+
 static session_config_t session_config = {
   .interface_type = DASH7,
   .d7ap_session_config = {
@@ -63,30 +91,36 @@ int main(void)
         .command_completed_callback = &on_modem_command_completed_callback,
         .return_file_data_callback = &on_modem_return_file_data_callback,
         .write_file_data_callback = &on_modem_write_file_data_callback,
+        .health_callback = &on_modem_health_callback,
     };
 
     modem_init(1, 9600);
     modem_cb_init(&modem_callbacks);
+    modem_watchdog_start(WATCHDOG_INTERVAL_MS, WATCHDOG_MAX_MISSES, GPIO_UNDEF);
 
     uint8_t uid[D7A_FILE_UID_SIZE];
     modem_read_file(D7A_FILE_UID_FILE_ID, 0, D7A_FILE_UID_SIZE, uid);
     printf("modem UID: %02X%02X%02X%02X%02X%02X%02X%02X\n", uid[0], uid[1], uid[2], uid[3], uid[4], uid[5], uid[6], uid[7]);
 
+    // Let the modem push the sensor file every time we write it (D7 action protocol), so every report only costs a local
+    // file write. When the modem does not support this we fall back to sending the unsolicited response ourselves.
+    session_config_t session_handle;
+    bool use_action_protocol = modem_register_session(INTERFACE_FILE_ID, &session_config, &session_handle) == MODEM_STATUS_COMMAND_COMPLETED_SUCCESS
+        && modem_enable_action_protocol(SENSOR_FILE_ID, ALP_ACT_COND_WRITE, ALP_CMD_FILE_ID, NULL, 0, INTERFACE_FILE_ID) == MODEM_STATUS_COMMAND_COMPLETED_SUCCESS;
+    printf("using action protocol: %i\n", use_action_protocol);
+
+    // readings are batched into compressed frames, which are sent through the uplink queue, so frames which could not be
+    // sent are retried in the background when the modem is available again
+    modem_uplink_init(&session_config, MODEM_UPLINK_DROP_OLDEST, NULL);
+    modem_sample_batch_init(&sample_batch, SENSOR_FILE_ID, use_action_protocol ? &write_sensor_file : NULL,
+                            BATCH_MAX_SAMPLES, BATCH_MAX_AGE_MS, INTERVAL / US_PER_SEC);
+
     xtimer_ticks32_t last_wakeup = xtimer_now();
     uint8_t counter = 0;
     while(1) {
-        printf("Sending msg with counter %i\n", counter);
-        uint32_t start = xtimer_now_usec();
-        modem_status_t status = modem_send_unsolicited_response(0x40, 0, 1, &counter, &session_config);
-        uint32_t duration_usec = xtimer_now_usec() - start;
-        printf("Command completed in %li ms\n", duration_usec / 1000);
-        if(status == MODEM_STATUS_COMMAND_COMPLETED_SUCCESS) {
-            printf("Command completed successfully\n");
-        } else if(status == MODEM_STATUS_COMMAND_COMPLETED_ERROR) {
-            printf("Command completed with error\n");
-        } else if(status == MODEM_STATUS_COMMAND_TIMEOUT) {
-            printf("Command timed out\n");
-        }
+        printf("Adding sample with counter %i\n", counter);
+        if(!modem_sample_batch_add(&sample_batch, counter))
+            printf("Batch lost\n");
 
         counter++;
         xtimer_periodic_wakeup(&last_wakeup, INTERVAL);
@@ -23,6 +23,11 @@ void on_modem_write_file_data_callback(uint8_t file_id, uint32_t offset, uint32_
     printf("modem write file data file %i offset %li size %li buffer %p", file_id, offset, size, output_buffer);
 }
 
+static const shell_command_t shell_commands[] = {
+    { "modem_trace", "print the latency trace of the modem commands", modem_trace_shell_cmd },
+    { NULL, NULL, NULL }
+};
+
 int main(void)
 {
     puts("Welcome to RIOT!");
@@ -40,7 +45,7 @@ int main(void)
         uid[0], uid[1], uid[2], uid[3], uid[4], uid[5], uid[6], uid[7]);
     
     char line_buf[SHELL_DEFAULT_BUFSIZE];
-    shell_run(NULL, line_buf, SHELL_DEFAULT_BUFSIZE);
+    shell_run(shell_commands, line_buf, SHELL_DEFAULT_BUFSIZE);
 
     return 0;
 }
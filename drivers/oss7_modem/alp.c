@@ -21,6 +21,7 @@
  */
 
 #include "stdlib.h"
+#include "string.h"
 #include "debug.h"
 #include "errors.h"
 
@@ -38,6 +39,117 @@
 #endif
 
 
+// The layout of every supported action is described by the operands following the opcode. This single description is
+// used to compute the coded size when appending an action, to parse or skip received actions and to predict the size of
+// the response to a command.
+typedef enum {
+  OPERAND_NONE = 0, // end of the operand list
+  OPERAND_BYTE, // file ID, tag ID or interface file ID
+  OPERAND_LENGTH, // length operand, also used for file offsets
+  OPERAND_FILE_HEADER, // coded file header, ALP_FILE_HEADER_SIZE bytes
+  // the variable size operands below are always the last operand of an action
+  OPERAND_DATA, // as many bytes as the value of the preceding length operand
+  OPERAND_INTERFACE_CONFIG, // interface ID followed by the interface configuration
+  OPERAND_QUERY, // query code, compare length, compare values and file offset(s)
+  OPERAND_STATUS, // interface ID followed by the interface status when b6 is set, otherwise action index and status code
+  OPERAND_OVERLOADED_ADDRESSEE, // D7 addressee (ctrl, access class and ID) when b7 is set, otherwise empty
+  OPERAND_AUTHENTICATION_DATA, // depends on the authentication protocol, not supported
+} operand_type_t;
+
+#define MAX_OPERANDS 4
+
+typedef struct {
+  uint8_t op;
+  uint8_t response_op; // the action returned by the modem for this action, ALP_OP_NOP if none
+  uint8_t operands[MAX_OPERANDS]; // operand_type_t, ended by OPERAND_NONE
+} op_descriptor_t;
+
+// all operations of alp_operation_t, file operations without operands below only take a file ID
+static const op_descriptor_t op_descriptors[] = {
+  { ALP_OP_NOP, ALP_OP_NOP, { OPERAND_NONE } },
+  { ALP_OP_READ_FILE_DATA, ALP_OP_RETURN_FILE_DATA, { OPERAND_BYTE, OPERAND_LENGTH, OPERAND_LENGTH } },
+  { ALP_OP_READ_FILE_PROPERTIES, ALP_OP_RETURN_FILE_PROPERTIES, { OPERAND_BYTE } },
+  { ALP_OP_WRITE_FILE_DATA, ALP_OP_NOP, { OPERAND_BYTE, OPERAND_LENGTH, OPERAND_LENGTH, OPERAND_DATA } },
+  { ALP_OP_WRITE_FILE_DATA_FLUSH, ALP_OP_NOP, { OPERAND_BYTE, OPERAND_LENGTH, OPERAND_LENGTH, OPERAND_DATA } },
+  { ALP_OP_WRITE_FILE_PROPERTIES, ALP_OP_NOP, { OPERAND_BYTE, OPERAND_FILE_HEADER } },
+  { ALP_OP_ACTION_QUERY, ALP_OP_NOP, { OPERAND_QUERY } },
+  { ALP_OP_BREAK_QUERY, ALP_OP_NOP, { OPERAND_QUERY } },
+  { ALP_OP_PERMISSION_REQUEST, ALP_OP_NOP, { OPERAND_BYTE, OPERAND_BYTE, OPERAND_AUTHENTICATION_DATA } }, // level, protocol
+  { ALP_OP_VERIFY_CHECKSUM, ALP_OP_NOP, { OPERAND_QUERY } },
+  { ALP_OP_EXIST_FILE, ALP_OP_NOP, { OPERAND_BYTE } },
+  { ALP_OP_CREATE_FILE, ALP_OP_NOP, { OPERAND_BYTE, OPERAND_FILE_HEADER } },
+  { ALP_OP_DELETE_FILE, ALP_OP_NOP, { OPERAND_BYTE } },
+  { ALP_OP_RESTORE_FILE, ALP_OP_NOP, { OPERAND_BYTE } },
+  { ALP_OP_FLUSH_FILE, ALP_OP_NOP, { OPERAND_BYTE } },
+  { ALP_OP_OPEN_FILE, ALP_OP_NOP, { OPERAND_BYTE } },
+  { ALP_OP_CLOSE_FILE, ALP_OP_NOP, { OPERAND_BYTE } },
+  { ALP_OP_COPY_FILE, ALP_OP_NOP, { OPERAND_BYTE, OPERAND_BYTE } }, // source and destination file ID
+  { ALP_OP_EXECUTE_FILE, ALP_OP_NOP, { OPERAND_BYTE } },
+  { ALP_OP_RETURN_FILE_DATA, ALP_OP_NOP, { OPERAND_BYTE, OPERAND_LENGTH, OPERAND_LENGTH, OPERAND_DATA } },
+  { ALP_OP_RETURN_FILE_PROPERTIES, ALP_OP_NOP, { OPERAND_BYTE, OPERAND_FILE_HEADER } },
+  { ALP_OP_RETURN_STATUS, ALP_OP_NOP, { OPERAND_STATUS } },
+  { ALP_OP_RETURN_TAG, ALP_OP_NOP, { OPERAND_BYTE } },
+  { ALP_OP_CHUNK, ALP_OP_NOP, { OPERAND_NONE } }, // the chunk step is coded in the control bits
+  { ALP_OP_LOGIC, ALP_OP_NOP, { OPERAND_NONE } }, // the logic code is coded in the control bits
+  { ALP_OP_FORWARD, ALP_OP_RETURN_STATUS, { OPERAND_INTERFACE_CONFIG } }, // the interface status of every response
+  { ALP_OP_INDIRECT_FORWARD, ALP_OP_RETURN_STATUS, { OPERAND_BYTE, OPERAND_OVERLOADED_ADDRESSEE } },
+  { ALP_OP_REQUEST_TAG, ALP_OP_NOP, { OPERAND_BYTE } },
+};
+
+// the decoded operands of an action
+typedef struct {
+  uint32_t values[MAX_OPERANDS]; // the values of the byte and length operands, by operand index
+  fifo_view_t data; // the file header or variable size operand, pointing in the parsed fifo
+} operands_t;
+
+#define D7AP_SESSION_RESULT_CODED_SIZE 12 // without the addressee ID
+#define LORAWAN_SESSION_RESULT_CODED_SIZE 4
+#define INTERFACE_STATUS_MAX_DECODED_SIZE (1 + D7AP_SESSION_RESULT_CODED_SIZE + D7A_FILE_UID_SIZE) // the D7 status is the largest
+#define INTERFACE_STATUS_MAX_CODED_SIZE INTERFACE_STATUS_MAX_DECODED_SIZE // the D7 status is not length prefixed
+
+// returns NULL when the operation is not supported
+static const op_descriptor_t* get_descriptor(uint8_t op) {
+  op &= 0x3F; // op is in b5-b0
+  for(uint8_t i = 0; i < sizeof(op_descriptors) / sizeof(op_descriptors[0]); i++) {
+    if(op_descriptors[i].op == op)
+      return &op_descriptors[i];
+  }
+
+  return NULL;
+}
+
+// the size of the data operand, which is given by the preceding length operand
+static uint32_t get_data_length(const op_descriptor_t* descriptor, const uint32_t* values) {
+  for(uint8_t i = 1; i < MAX_OPERANDS; i++) {
+    if(descriptor->operands[i] == OPERAND_DATA)
+      return values[i - 1];
+  }
+
+  return 0;
+}
+
+// the coded size of an action, variable_length is the size of its variable size operand (if any)
+static uint32_t get_action_coded_length(const op_descriptor_t* descriptor, const uint32_t* values, uint32_t variable_length) {
+  uint32_t length = 1; // opcode
+  for(uint8_t i = 0; i < MAX_OPERANDS && descriptor->operands[i] != OPERAND_NONE; i++) {
+    switch(descriptor->operands[i]) {
+      case OPERAND_BYTE:
+        length += 1;
+        break;
+      case OPERAND_LENGTH:
+        length += alp_length_operand_coded_length(values[i]);
+        break;
+      case OPERAND_FILE_HEADER:
+        length += ALP_FILE_HEADER_SIZE;
+        break;
+      default:
+        length += variable_length;
+    }
+  }
+
+  return length;
+}
+
 alp_operation_t alp_get_operation(uint8_t* alp_command)
 {
     alp_control_t alp_ctrl;
@@ -45,39 +157,113 @@ alp_operation_t alp_get_operation(uint8_t* alp_command)
     return alp_ctrl.operation;
 }
 
+static error_t pop_length_operand(fifo_t* fifo, uint32_t* length) {
+  uint8_t coded[4];
+  if(fifo_pop(fifo, coded, 1) != SUCCESS)
+    return ESIZE;
+
+  uint8_t field_len = coded[0] >> 6;
+  if(fifo_pop(fifo, coded + 1, field_len) != SUCCESS)
+    return ESIZE;
+
+  *length = coded[0] & 0x3F; // mask field length specificier bits, the following bytes are big endian
+  for(uint8_t i = 1; i <= field_len; i++)
+    *length = (*length << 8) | coded[i];
+
+  return SUCCESS;
+}
+
 uint32_t alp_parse_length_operand(fifo_t* cmd_fifo) {
-  uint8_t len = 0;
-  fifo_pop(cmd_fifo, (uint8_t*)&len, 1);
-  uint8_t field_len = len >> 6;
-  if(field_len == 0)
-    return (uint32_t)len;
+  uint32_t length = 0;
+  pop_length_operand(cmd_fifo, &length);
+  return length;
+}
+
+// The encoders below first compute the exact size of the action, reserve this contiguous space in the fifo at once and
+// write the fields directly, instead of putting them byte per byte. The write_* helpers return the position after the
+// written bytes.
+static uint8_t* write_length_operand(uint8_t* ptr, uint32_t length) {
+  uint8_t size = alp_length_operand_coded_length(length) - 1; // number of bytes following the first byte
+  *ptr++ = (size << 6) | (uint8_t)(length >> (8 * size)); // length specifier bits and the most significant bits
+  while(size > 0) {
+    size--;
+    *ptr++ = (uint8_t)(length >> (8 * size));
+  }
 
-  uint32_t full_length = (len & 0x3F) << ( 8 * field_len); // mask field length specificier bits and shift before adding other length bytes
-  fifo_pop(cmd_fifo, (uint8_t*)&full_length, field_len);
-  return full_length;
+  return ptr;
 }
 
-void alp_append_length_operand(fifo_t* fifo, uint32_t length) {
-  if(length < 64) {
-    // can be coded in one byte
-    assert(fifo_put(fifo, (uint8_t*)&length, 1) == SUCCESS);
-    return;
+static uint8_t* write_file_offset_operand(uint8_t* ptr, uint8_t file_id, uint32_t offset) {
+  *ptr++ = file_id;
+  return write_length_operand(ptr, offset);
+}
+
+static uint8_t* write_bytes(uint8_t* ptr, const uint8_t* data, uint16_t length) {
+  memcpy(ptr, data, length);
+  return ptr + length;
+}
+
+static uint8_t* write_uint32_be(uint8_t* ptr, uint32_t value) {
+  *ptr++ = value >> 24;
+  *ptr++ = value >> 16;
+  *ptr++ = value >> 8;
+  *ptr++ = value;
+  return ptr;
+}
+
+static uint8_t file_offset_operand_coded_length(uint32_t offset) {
+  return 1 + alp_length_operand_coded_length(offset);
+}
+
+// reserves the complete action in fifo and writes the opcode and the byte and length operands, the file header or
+// variable size operand is written by the caller at the returned position
+static uint8_t* reserve_action(fifo_t* fifo, uint8_t op, const uint32_t* values, uint32_t variable_length) {
+  const op_descriptor_t* descriptor = get_descriptor(op);
+  assert(descriptor != NULL);
+  uint32_t length = get_action_coded_length(descriptor, values, variable_length);
+  if(length > fifo->max_size)
+    return NULL; // would be truncated by fifo_reserve()
+
+  uint8_t* ptr = fifo_reserve(fifo, length);
+  if(!ptr)
+    return NULL;
+
+  *ptr++ = op;
+  for(uint8_t i = 0; i < MAX_OPERANDS; i++) {
+    if(descriptor->operands[i] == OPERAND_BYTE)
+      *ptr++ = values[i];
+    else if(descriptor->operands[i] == OPERAND_LENGTH)
+      ptr = write_length_operand(ptr, values[i]);
+    else
+      break;
   }
 
-  uint8_t size = 1;
-  if(length > 0x3FFF)
-    size = 2;
-  if(length > 0x3FFFFF)
-    size = 3;
+  return ptr;
+}
 
-  uint8_t byte = 0;
-  byte += (size << 6); // length specifier bits
-  byte += ((uint8_t*)(&length))[size];
-  assert(fifo_put(fifo, &byte, 1) == SUCCESS);
-  do {
-    size--;
-    assert(fifo_put(fifo, (uint8_t*)&length + size, 1) == SUCCESS);
-  } while(size > 0);
+// appends an action, data is the data operand which is data_length bytes. When data is NULL only the action header is
+// appended, and the caller is responsible for appending the data afterwards.
+static error_t append_action(fifo_t* fifo, uint8_t op, const uint32_t* values, const uint8_t* data, uint32_t data_length) {
+  if(data && data_length > fifo->max_size)
+    return ESIZE; // the length operand encodes the full length, while the reserved size would be truncated
+
+  uint8_t* ptr = reserve_action(fifo, op, values, data ? data_length : 0);
+  if(!ptr)
+    return ESIZE;
+
+  if(data)
+    write_bytes(ptr, data, data_length);
+
+  return SUCCESS;
+}
+
+error_t alp_append_length_operand(fifo_t* fifo, uint32_t length) {
+  uint8_t* ptr = fifo_reserve(fifo, alp_length_operand_coded_length(length));
+  if(!ptr)
+    return ESIZE;
+
+  write_length_operand(ptr, length);
+  return SUCCESS;
 }
 
 alp_operand_file_offset_t alp_parse_file_offset_operand(fifo_t* cmd_fifo) {
@@ -87,61 +273,217 @@ alp_operand_file_offset_t alp_parse_file_offset_operand(fifo_t* cmd_fifo) {
   return operand;
 }
 
-void alp_append_file_offset_operand(fifo_t* fifo, uint8_t file_id, uint32_t offset) {
-  assert(fifo_put_byte(fifo, file_id) == SUCCESS);
-  alp_append_length_operand(fifo, offset);
+error_t alp_append_file_offset_operand(fifo_t* fifo, uint8_t file_id, uint32_t offset) {
+  uint8_t* ptr = fifo_reserve(fifo, file_offset_operand_coded_length(offset));
+  if(!ptr)
+    return ESIZE;
+
+  write_file_offset_operand(ptr, file_id, offset);
+  return SUCCESS;
 }
 
-void alp_append_forward_action(fifo_t* fifo, uint8_t itf_id, uint8_t *config, uint8_t config_len) {
-  assert(config!=NULL);
-  assert(fifo_put_byte(fifo, ALP_OP_FORWARD) == SUCCESS);
-  assert(fifo_put_byte(fifo, itf_id) == SUCCESS);
+// the coded size of an interface configuration, including the interface ID
+static uint8_t get_interface_config_length(uint8_t itf_id, uint8_t addressee_ctrl, uint8_t config_len) {
+  switch(itf_id) {
+    case ALP_ITF_ID_D7ASP: ;
+      d7ap_addressee_ctrl_t ctrl = { .raw = addressee_ctrl };
+      return 1 + 4 + d7ap_addressee_id_length(ctrl.id_type); // QoS, dormant timeout, addressee ctrl, access class and ID
+    case ALP_ITF_ID_LORAWAN_ABP:
+      return 1 + 2 + 16 + 16 + 4 + 4;
+    case ALP_ITF_ID_LORAWAN_OTAA:
+      return 1 + 2 + 8 + 8 + 16;
+    default:
+      return 1 + config_len;
+  }
+}
+
+uint8_t alp_interface_config_coded_length(uint8_t itf_id, uint8_t *config, uint8_t config_len) {
+  uint8_t addressee_ctrl = itf_id == ALP_ITF_ID_D7ASP ? ((d7ap_session_config_t*)config)->addressee.ctrl.raw : 0;
+  return get_interface_config_length(itf_id, addressee_ctrl, config_len);
+}
 
+static uint8_t* write_interface_config(uint8_t* ptr, uint8_t itf_id, uint8_t *config, uint8_t config_len) {
+  *ptr++ = itf_id;
   if (itf_id == ALP_ITF_ID_D7ASP)
   {
-    assert(fifo_put_byte(fifo, ((d7ap_session_config_t*)config)->qos.raw) == SUCCESS);
-    assert(fifo_put_byte(fifo, ((d7ap_session_config_t*)config)->dormant_timeout) == SUCCESS);
-    assert(fifo_put_byte(fifo, ((d7ap_session_config_t*)config)->addressee.ctrl.raw) == SUCCESS);
-    uint8_t id_length = d7ap_addressee_id_length(((d7ap_session_config_t*)config)->addressee.ctrl.id_type);
-    assert(fifo_put_byte(fifo, ((d7ap_session_config_t*)config)->addressee.access_class) == SUCCESS);
-    assert(fifo_put(fifo, ((d7ap_session_config_t*)config)->addressee.id, id_length) == SUCCESS);
+    d7ap_session_config_t* d7_config = (d7ap_session_config_t*)config;
+    *ptr++ = d7_config->qos.raw;
+    *ptr++ = d7_config->dormant_timeout;
+    *ptr++ = d7_config->addressee.ctrl.raw;
+    *ptr++ = d7_config->addressee.access_class;
+    ptr = write_bytes(ptr, d7_config->addressee.id, d7ap_addressee_id_length(d7_config->addressee.ctrl.id_type));
   }
   else if(itf_id == ALP_ITF_ID_LORAWAN_ABP)
   {
-    uint8_t control_byte = ((lorawan_session_config_abp_t*)config)->request_ack << 1;
-    assert(fifo_put_byte(fifo, control_byte) == SUCCESS);
-    assert(fifo_put_byte(fifo, ((lorawan_session_config_abp_t*)config)->application_port) == SUCCESS);
-    assert(fifo_put(fifo, ((lorawan_session_config_abp_t*)config)->nwkSKey, 16) == SUCCESS);
-    assert(fifo_put(fifo, ((lorawan_session_config_abp_t*)config)->appSKey, 16) == SUCCESS);
-    uint32_t dev_addr = __builtin_bswap32(((lorawan_session_config_abp_t*)config)->devAddr);
-    assert(fifo_put(fifo, (uint8_t*)&dev_addr, 4) == SUCCESS);
-    uint32_t network_id = __builtin_bswap32(((lorawan_session_config_abp_t*)config)->network_id);
-    
-    assert(fifo_put(fifo, (uint8_t*)&network_id, 4) == SUCCESS);    
+    lorawan_session_config_abp_t* abp_config = (lorawan_session_config_abp_t*)config;
+    *ptr++ = abp_config->request_ack << 1;
+    *ptr++ = abp_config->application_port;
+    ptr = write_bytes(ptr, abp_config->nwkSKey, 16);
+    ptr = write_bytes(ptr, abp_config->appSKey, 16);
+    ptr = write_uint32_be(ptr, abp_config->devAddr);
+    ptr = write_uint32_be(ptr, abp_config->network_id);
   }
   else if(itf_id == ALP_ITF_ID_LORAWAN_OTAA)
   {
-    uint8_t control_byte = ((lorawan_session_config_otaa_t*)config)->request_ack << 1;
-    assert(fifo_put_byte(fifo, control_byte) == SUCCESS);
-    assert(fifo_put_byte(fifo, ((lorawan_session_config_otaa_t*)config)->application_port) == SUCCESS);
-    assert(fifo_put(fifo, ((lorawan_session_config_otaa_t*)config)->devEUI, 8) == SUCCESS);
-    assert(fifo_put(fifo, ((lorawan_session_config_otaa_t*)config)->appEUI, 8) == SUCCESS);
-    assert(fifo_put(fifo, ((lorawan_session_config_otaa_t*)config)->appKey, 16) == SUCCESS);
+    lorawan_session_config_otaa_t* otaa_config = (lorawan_session_config_otaa_t*)config;
+    *ptr++ = otaa_config->request_ack << 1;
+    *ptr++ = otaa_config->application_port;
+    ptr = write_bytes(ptr, otaa_config->devEUI, 8);
+    ptr = write_bytes(ptr, otaa_config->appEUI, 8);
+    ptr = write_bytes(ptr, otaa_config->appKey, 16);
   }
   else
   {
-    assert(fifo_put(fifo, config, config_len) == SUCCESS);
+    ptr = write_bytes(ptr, config, config_len);
   }
 
+  return ptr;
+}
+
+error_t alp_append_interface_config(fifo_t* fifo, uint8_t itf_id, uint8_t *config, uint8_t config_len) {
+  assert(config!=NULL);
+  uint8_t* ptr = fifo_reserve(fifo, alp_interface_config_coded_length(itf_id, config, config_len));
+  if(!ptr)
+    return ESIZE;
+
+  write_interface_config(ptr, itf_id, config, config_len);
+  return SUCCESS;
+}
+
+error_t alp_append_forward_action(fifo_t* fifo, uint8_t itf_id, uint8_t *config, uint8_t config_len) {
+  assert(config!=NULL);
+  uint8_t* ptr = reserve_action(fifo, ALP_OP_FORWARD, NULL, alp_interface_config_coded_length(itf_id, config, config_len));
+  if(!ptr)
+    return ESIZE;
+
+  write_interface_config(ptr, itf_id, config, config_len);
   DPRINT("FORWARD");
+  return SUCCESS;
+}
+
+error_t alp_append_indirect_forward_action(fifo_t* fifo, uint8_t interface_file_id) {
+  uint32_t values[] = { interface_file_id };
+  DPRINT("INDIRECT FORWARD");
+  return append_action(fifo, ALP_OP_INDIRECT_FORWARD, values, NULL, 0); // no overloaded config
+}
+
+error_t alp_append_return_file_data_header(fifo_t* fifo, uint8_t file_id, uint32_t offset, uint32_t length) {
+  uint32_t values[] = { file_id, offset, length };
+  return append_action(fifo, ALP_OP_RETURN_FILE_DATA, values, NULL, 0);
+}
+
+error_t alp_append_return_file_data_action(fifo_t* fifo, uint8_t file_id, uint32_t offset, uint32_t length, uint8_t* data) {
+  uint32_t values[] = { file_id, offset, length };
+  return append_action(fifo, ALP_OP_RETURN_FILE_DATA, values, data, length);
+}
+
+error_t alp_append_read_file_properties_action(fifo_t* fifo, uint8_t file_id, bool resp, bool group) {
+  uint32_t values[] = { file_id };
+  return append_action(fifo, ALP_OP_READ_FILE_PROPERTIES | (resp << 6) | (group << 7), values, NULL, 0);
+}
+
+error_t alp_append_write_file_properties_action(fifo_t* fifo, uint8_t file_id, const fs_file_header_t* file_header, bool resp, bool group) {
+  uint32_t values[] = { file_id };
+  uint8_t* ptr = reserve_action(fifo, ALP_OP_WRITE_FILE_PROPERTIES | (resp << 6) | (group << 7), values, 0);
+  if(!ptr)
+    return ESIZE;
+
+  *ptr++ = file_header->file_permissions;
+  memcpy(ptr++, &file_header->file_properties, 1);
+  *ptr++ = file_header->alp_cmd_file_id;
+  *ptr++ = file_header->interface_file_id;
+  ptr = write_uint32_be(ptr, file_header->length);
+  write_uint32_be(ptr, file_header->allocated_length);
+  DPRINT("WRITE FILE PROPERTIES");
+  return SUCCESS;
+}
+
+void alp_decode_file_header(const uint8_t* coded_file_header, fs_file_header_t* file_header) {
+  file_header->file_permissions = coded_file_header[0];
+  memcpy(&file_header->file_properties, &coded_file_header[1], 1);
+  file_header->alp_cmd_file_id = coded_file_header[2];
+  file_header->interface_file_id = coded_file_header[3];
+  uint32_t length_be;
+  memcpy(&length_be, &coded_file_header[4], 4);
+  file_header->length = __builtin_bswap32(length_be);
+  memcpy(&length_be, &coded_file_header[8], 4);
+  file_header->allocated_length = __builtin_bswap32(length_be);
+}
+
+void alp_init_arithmetic_query(alp_query_t* query, uint8_t file_id, uint32_t offset, uint8_t compare_length,
+                               alp_query_arithmetic_comparison_type_t comparison_type, bool is_signed, uint32_t value) {
+  memset(query, 0, sizeof(alp_query_t));
+  query->type = QUERY_CODE_TYPE_ARITH_COMP_WITH_VALUE;
+  query->comparison_type = comparison_type;
+  query->is_signed = is_signed;
+  query->compare_length = compare_length;
+  query->value = value;
+  query->file_offset.file_id = file_id;
+  query->file_offset.offset = offset;
+}
+
+void alp_init_range_query(alp_query_t* query, uint8_t file_id, uint32_t offset, uint8_t compare_length,
+                          alp_query_range_comparison_type_t comparison_type, bool is_signed, uint32_t min_value, uint32_t max_value) {
+  memset(query, 0, sizeof(alp_query_t));
+  query->type = QUERY_CODE_TYPE_RANGE_COMP;
+  query->comparison_type = comparison_type;
+  query->is_signed = is_signed;
+  query->compare_length = compare_length;
+  query->value = min_value;
+  query->max_value = max_value;
+  query->file_offset.file_id = file_id;
+  query->file_offset.offset = offset;
+}
+
+// writes the compare_length least significant bytes of value, MSB first
+static uint8_t* write_compare_value(uint8_t* ptr, uint32_t value, uint8_t compare_length) {
+  while(compare_length > 0) {
+    compare_length--;
+    *ptr++ = (uint8_t)(value >> (8 * compare_length));
+  }
+
+  return ptr;
+}
+
+static bool is_mask_present(const alp_query_t* query) {
+  return query->type == QUERY_CODE_TYPE_ARITH_COMP_WITH_VALUE && query->mask != 0;
+}
+
+static uint8_t query_operand_coded_length(const alp_query_t* query) {
+  uint8_t value_count = 1 + is_mask_present(query) + (query->type == QUERY_CODE_TYPE_RANGE_COMP);
+  return 1 + alp_length_operand_coded_length(query->compare_length) + value_count * query->compare_length
+      + file_offset_operand_coded_length(query->file_offset.offset);
+}
+
+static error_t append_query_action(fifo_t* fifo, uint8_t op, const alp_query_t* query) {
+  assert(query->type == QUERY_CODE_TYPE_ARITH_COMP_WITH_VALUE || query->type == QUERY_CODE_TYPE_RANGE_COMP);
+  assert(query->compare_length > 0 && query->compare_length <= 4);
+  uint8_t* ptr = reserve_action(fifo, op, NULL, query_operand_coded_length(query));
+  if(!ptr)
+    return ESIZE;
+
+  bool mask_present = is_mask_present(query);
+  *ptr++ = (query->type << 5) | (mask_present << 4) | (query->is_signed << 3) | (query->comparison_type & 0x07);
+  ptr = write_length_operand(ptr, query->compare_length);
+  if(mask_present)
+    ptr = write_compare_value(ptr, query->mask, query->compare_length);
+
+  ptr = write_compare_value(ptr, query->value, query->compare_length);
+  if(query->type == QUERY_CODE_TYPE_RANGE_COMP)
+    ptr = write_compare_value(ptr, query->max_value, query->compare_length);
+
+  write_file_offset_operand(ptr, query->file_offset.file_id, query->file_offset.offset);
+  return SUCCESS;
 }
 
-void alp_append_return_file_data_action(fifo_t* fifo, uint8_t file_id, uint32_t offset, uint32_t length, uint8_t* data) {
-  assert(fifo_put_byte(fifo, ALP_OP_RETURN_FILE_DATA) == SUCCESS);
-  assert(fifo_put_byte(fifo, file_id) == SUCCESS);
-  alp_append_length_operand(fifo, offset);
-  alp_append_length_operand(fifo, length);
-  assert(fifo_put(fifo, data, length) == SUCCESS);
+error_t alp_append_action_query_action(fifo_t* fifo, const alp_query_t* query) {
+  DPRINT("ACTION QUERY");
+  return append_query_action(fifo, ALP_OP_ACTION_QUERY, query);
+}
+
+error_t alp_append_break_query_action(fifo_t* fifo, const alp_query_t* query) {
+  DPRINT("BREAK QUERY");
+  return append_query_action(fifo, ALP_OP_BREAK_QUERY, query);
 }
 
 // static void append_tag_response(fifo_t* fifo, uint8_t tag_id, bool eop, bool error) {
@@ -178,161 +520,383 @@ void alp_append_return_file_data_action(fifo_t* fifo, uint8_t file_id, uint32_t
 // }
 
 
-static void parse_operand_file_data(fifo_t* fifo, alp_action_t* action) {
-  action->file_data_operand.file_offset = alp_parse_file_offset_operand(fifo);
-  action->file_data_operand.provided_data_length = alp_parse_length_operand(fifo);
-  assert(action->file_data_operand.provided_data_length <= sizeof(action->file_data_operand.data));
-  fifo_pop(fifo, action->file_data_operand.data, action->file_data_operand.provided_data_length);
+// the length of the query operand at the head of fifo, which is popped
+static error_t pop_query_operand(fifo_t* fifo) {
+  uint8_t code;
+  uint32_t compare_length, offset;
+  if(fifo_pop(fifo, &code, 1) != SUCCESS || pop_length_operand(fifo, &compare_length) != SUCCESS)
+    return ESIZE;
+
+  bool arithmetic = true; // arithmetic comparisons are done on (at most) 32 bit integers
+  uint8_t compare_values = 0;
+  uint8_t file_offsets = 1;
+  uint32_t fixed_length = code & (1 << 4) ? compare_length : 0; // mask present
+  switch(code >> 5) {
+    case QUERY_CODE_TYPE_NON_VOID:
+      fixed_length = 0; // no mask
+      arithmetic = false;
+      break;
+    case QUERY_CODE_TYPE_ARITH_COMP_WITH_ZERO:
+      break;
+    case QUERY_CODE_TYPE_ARITH_COMP_WITH_VALUE:
+      compare_values = 1;
+      break;
+    case QUERY_CODE_TYPE_ARITH_COMP_BETWEEN_FILES:
+      file_offsets = 2;
+      break;
+    case QUERY_CODE_TYPE_RANGE_COMP:
+      compare_values = 2;
+      break;
+    case QUERY_CODE_TYPE_STRING_TOKEN:
+      compare_values = 1;
+      fixed_length++; // max errors
+      arithmetic = false; // the token may be longer
+      break;
+    default:
+      return EINVAL;
+  }
+
+  if(arithmetic && compare_length > 4)
+    return ESIZE;
+
+  uint32_t skip_length = fixed_length + compare_values * compare_length;
+  if(skip_length > UINT16_MAX || fifo_skip(fifo, skip_length) != SUCCESS)
+    return ESIZE;
+
+  for(uint8_t i = 0; i < file_offsets; i++) {
+    if(fifo_skip(fifo, 1) != SUCCESS || pop_length_operand(fifo, &offset) != SUCCESS) // file ID and offset
+      return ESIZE;
+  }
+
+  return SUCCESS;
 }
 
-static void parse_op_write_file_data(fifo_t* fifo, alp_action_t* action) {
-  parse_operand_file_data(fifo, action);
-  DPRINT("parsed write file data file %i, len %i", action->file_data_operand.file_offset.file_id, action->file_data_operand.provided_data_length);
+// pops an interface status, only the D7 status is not preceded by a length operand
+static error_t pop_interface_status(fifo_t* fifo) {
+  uint8_t itf_id;
+  if(fifo_pop(fifo, &itf_id, 1) != SUCCESS)
+    return ESIZE;
+
+  uint32_t length;
+  if(itf_id == ALP_ITF_ID_D7ASP) {
+    uint8_t coded[D7AP_SESSION_RESULT_CODED_SIZE];
+    if(fifo_pop(fifo, coded, sizeof(coded)) != SUCCESS)
+      return ESIZE;
+
+    d7ap_addressee_ctrl_t ctrl = { .raw = coded[10] };
+    length = d7ap_addressee_id_length(ctrl.id_type);
+  } else if(pop_length_operand(fifo, &length) != SUCCESS) {
+    return ESIZE;
+  }
+
+  return length > UINT16_MAX ? ESIZE : fifo_skip(fifo, length); // unknown interfaces are skipped by their length as well
 }
 
+// Determines the size of the variable size operand at the head of fifo, by parsing it from a copy of the fifo, so
+// nothing is popped from fifo itself. values contains the operands preceding the variable operand.
+static error_t get_variable_operand_length(fifo_t* fifo, uint8_t op, operand_type_t type, const uint32_t* values,
+                                           uint8_t index, uint32_t* length) {
+  fifo_t peek_fifo = *fifo;
+  uint8_t coded[2] = { 0 };
+  error_t err = SUCCESS;
+  switch(type) {
+    case OPERAND_FILE_HEADER:
+      *length = ALP_FILE_HEADER_SIZE;
+      return SUCCESS;
+    case OPERAND_DATA:
+      *length = values[index - 1];
+      return SUCCESS;
+    case OPERAND_INTERFACE_CONFIG:
+      if(fifo_pop(&peek_fifo, coded, 1) != SUCCESS)
+        return ESIZE;
+
+      // the addressee ctrl follows the interface ID, QoS and dormant timeout
+      if(coded[0] == ALP_ITF_ID_D7ASP && (fifo_skip(&peek_fifo, 2) != SUCCESS || fifo_pop(&peek_fifo, coded + 1, 1) != SUCCESS))
+        return ESIZE;
+
+      *length = get_interface_config_length(coded[0], coded[1], 0); // other interfaces have no configuration
+      return SUCCESS;
+    case OPERAND_QUERY:
+      err = pop_query_operand(&peek_fifo);
+      break;
+    case OPERAND_STATUS:
+      if(op & (1 << 6))
+        err = pop_interface_status(&peek_fifo);
+      else
+        err = fifo_skip(&peek_fifo, 2); // action index and status code
+      break;
+    case OPERAND_OVERLOADED_ADDRESSEE:
+      if(!(op & (1 << 7))) {
+        *length = 0;
+        return SUCCESS;
+      }
+
+      if(fifo_pop(&peek_fifo, coded, 1) != SUCCESS)
+        return ESIZE;
+
+      d7ap_addressee_ctrl_t ctrl = { .raw = coded[0] };
+      *length = 2 + d7ap_addressee_id_length(ctrl.id_type);
+      return SUCCESS;
+    default:
+      DPRINT("operand type %i not supported", type);
+      return EINVAL;
+  }
 
-static void parse_op_return_file_data(fifo_t* fifo, alp_action_t* action) {
-  parse_operand_file_data(fifo, action);
-  DPRINT("parsed return file data file %i, len %i", action->file_data_operand.file_offset.file_id, action->file_data_operand.provided_data_length);
+  *length = fifo_get_size(fifo) - fifo_get_size(&peek_fifo);
+  return err;
 }
 
-static void parse_op_return_tag(fifo_t* fifo, alp_action_t* action, bool b6, bool b7) {
-  action->tag_response.completed = b7;
-  action->tag_response.error = b6;
-  assert(fifo_pop(fifo, &action->tag_response.tag_id, 1) == SUCCESS);
-  DPRINT("parsed return tag %i, eop %i, err %i", action->tag_response.tag_id, action->tag_response.completed, action->tag_response.error);
+// pops the operands of an action, the opcode is popped already
+static error_t parse_operands(fifo_t* fifo, uint8_t op, const op_descriptor_t* descriptor, operands_t* operands) {
+  for(uint8_t i = 0; i < MAX_OPERANDS && descriptor->operands[i] != OPERAND_NONE; i++) {
+    error_t err;
+    uint8_t byte;
+    uint32_t length;
+    switch(descriptor->operands[i]) {
+      case OPERAND_BYTE:
+        err = fifo_pop(fifo, &byte, 1);
+        operands->values[i] = byte;
+        break;
+      case OPERAND_LENGTH:
+        err = pop_length_operand(fifo, &operands->values[i]);
+        break;
+      default:
+        err = get_variable_operand_length(fifo, op, descriptor->operands[i], operands->values, i, &length);
+        if(err == SUCCESS)
+          err = length > fifo_get_size(fifo) ? ESIZE : fifo_pop_view(fifo, &operands->data, length);
+    }
+
+    if(err != SUCCESS)
+      return err;
+  }
+
+  return SUCCESS;
 }
 
-static void parse_op_return_status(fifo_t* fifo, alp_action_t* action, bool b6, bool b7) {
-  assert(b6 && !b7); // TODO implement action status
-  uint8_t itf_id;
-  assert(fifo_pop(fifo, &itf_id, 1) == SUCCESS);
-  assert(itf_id == 0xD7); // TODO only D7 supported for now
-  // TODO uint32_t itf_len = parse_length_operand(fifo);
-  // assert(itf_len == sizeof(d7ap_session_result_t));
-  if (itf_id == ALP_ITF_ID_D7ASP)
-  {
-    d7ap_session_result_t interface_status =  *((d7ap_session_result_t*)action->status.data);
-
-    fifo_pop(fifo, &interface_status.channel.channel_header, 1);
-    fifo_pop(fifo, (uint8_t*)&interface_status.channel.center_freq_index, 2);
-    interface_status.channel.center_freq_index = __builtin_bswap16(interface_status.channel.center_freq_index);
-    fifo_pop(fifo, &interface_status.rx_level, 1);
-    fifo_pop(fifo, &interface_status.link_budget, 1);
-    fifo_pop(fifo, &interface_status.target_rx_level, 1);
-    fifo_pop(fifo, &interface_status.status.raw, 1);
-    fifo_pop(fifo, &interface_status.fifo_token, 1);
-    fifo_pop(fifo, &interface_status.seqnr, 1);
-    fifo_pop(fifo, &interface_status.response_to, 1);
-    fifo_pop(fifo, &interface_status.addressee.ctrl.raw, 1);
-    fifo_pop(fifo, &interface_status.addressee.access_class, 1);
-    uint8_t addressee_len = d7ap_addressee_id_length(interface_status.addressee.ctrl.id_type);
-    assert(fifo_pop(fifo, interface_status.addressee.id, addressee_len) == SUCCESS);
+static void decode_d7ap_session_result(const uint8_t* coded, d7ap_session_result_t* result) {
+  memset(result, 0, sizeof(d7ap_session_result_t));
+  result->channel.channel_header = coded[0];
+  result->channel.center_freq_index = (coded[1] << 8) | coded[2];
+  result->rx_level = coded[3];
+  result->link_budget = coded[4];
+  result->target_rx_level = coded[5];
+  result->status.raw = coded[6];
+  result->fifo_token = coded[7];
+  result->seqnr = coded[8];
+  result->response_to = coded[9];
+  result->addressee.ctrl.raw = coded[10];
+  result->addressee.access_class = coded[11];
+  memcpy(result->addressee.id, coded + D7AP_SESSION_RESULT_CODED_SIZE, d7ap_addressee_id_length(result->addressee.ctrl.id_type));
+}
+
+static void visit_file_data(alp_parser_t* parser, operands_t* operands, void (*callback)(alp_operand_file_data_t*, void*)) {
+  alp_operand_file_data_t operand = {
+    .file_offset = { .file_id = operands->values[0], .offset = operands->values[1] },
+    .provided_data_length = operands->values[2],
+    .data = operands->data // no copy, data is referenced in the fifo directly
+  };
+
+  DPRINT("parsed file data file %i, len %i", operand.file_offset.file_id, operand.provided_data_length);
+  if(callback)
+    callback(&operand, parser->arg);
+}
+
+static void visit_return_file_properties(alp_parser_t* parser, operands_t* operands) {
+  alp_operand_file_header_t operand = { .file_id = operands->values[0] };
+  fifo_view_copy(&operands->data, operand.file_header);
+  DPRINT("parsed return file properties file %i", operand.file_id);
+  if(parser->visitor->return_file_properties)
+    parser->visitor->return_file_properties(&operand, parser->arg);
+}
+
+static void decode_lorawan_session_result(const uint8_t* coded, lorawan_session_result_t* result) {
+  result->attempts = coded[0];
+  result->error_state = coded[1];
+  result->duty_cycle_wait_time = (coded[2] << 8) | coded[3];
+}
+
+// copies at most max_length bytes of the start of view, returns the number of copied bytes
+static uint16_t copy_view_start(const fifo_view_t* view, uint8_t* buffer, uint16_t max_length) {
+  fifo_view_t start = *view;
+  if(start.part1_len > max_length)
+    start.part1_len = max_length;
+
+  if(start.part1_len + start.part2_len > max_length)
+    start.part2_len = max_length - start.part1_len;
+
+  fifo_view_copy(&start, buffer);
+  return start.part1_len + start.part2_len;
+}
+
+static void visit_return_status(alp_parser_t* parser, uint8_t op, operands_t* operands) {
+  uint8_t coded[INTERFACE_STATUS_MAX_DECODED_SIZE];
+  uint16_t coded_length = copy_view_start(&operands->data, coded, sizeof(coded));
+  if(!(op & (1 << 6))) {
+    DPRINT("parsed action status %i for action %i", coded[1], coded[0]);
+    if(parser->visitor->action_status)
+      parser->visitor->action_status(coded[0], coded[1], parser->arg);
+
+    return;
+  }
+
+  if(!parser->visitor->return_status)
+    return;
+
+  alp_interface_status_t status;
+  memset(&status, 0, sizeof(status));
+  status.itf_id = coded[0];
+  if(status.itf_id == ALP_ITF_ID_D7ASP) {
+    decode_d7ap_session_result(coded + 1, &status.d7ap_session_result); // the length is checked while parsing
+  } else {
+    // the status follows the interface ID and length operand
+    fifo_t fifo;
+    fifo_init_filled(&fifo, coded, coded_length, coded_length + 1);
+    fifo_skip(&fifo, 1);
+    uint32_t length = 0;
+    pop_length_operand(&fifo, &length);
+    uint8_t header_length = coded_length - fifo_get_size(&fifo);
+    if((status.itf_id == ALP_ITF_ID_LORAWAN_ABP || status.itf_id == ALP_ITF_ID_LORAWAN_OTAA)
+       && length >= LORAWAN_SESSION_RESULT_CODED_SIZE)
+      decode_lorawan_session_result(coded + header_length, &status.lorawan_session_result);
   }
 
   DPRINT("parsed interface status");
+  parser->visitor->return_status(&status, parser->arg);
 }
 
-void alp_parse_action(fifo_t* fifo, alp_action_t* action) {
+void alp_parser_init(alp_parser_t* parser, fifo_t* fifo, const alp_visitor_t* visitor, void* arg) {
+  parser->fifo = fifo;
+  parser->visitor = visitor;
+  parser->arg = arg;
+}
+
+bool alp_parser_done(alp_parser_t* parser) {
+  return fifo_get_size(parser->fifo) == 0;
+}
+
+error_t alp_parser_next(alp_parser_t* parser) {
   uint8_t op;
-  assert(fifo_pop(fifo, &op, 1) == SUCCESS);
+  if(fifo_pop(parser->fifo, &op, 1) != SUCCESS)
+    return ESIZE;
+
   bool b6 = (op >> 6) & 1;
   bool b7 = op >> 7;
-  op &= 0x3F; // op is in b5-b0
-  action->operation = op;
-  switch(op) {
+  const op_descriptor_t* descriptor = get_descriptor(op);
+  operands_t operands;
+  error_t err = EINVAL;
+  if(!descriptor)
+    DPRINT("op %x unknown", op & 0x3F);
+  else
+    err = parse_operands(parser->fifo, op, descriptor, &operands);
+
+  if(err != SUCCESS) {
+    // without a description of the action the start of the next action is unknown
+    fifo_skip(parser->fifo, fifo_get_size(parser->fifo));
+    return err;
+  }
+
+  switch(descriptor->op) {
     case ALP_OP_WRITE_FILE_DATA:
-      parse_op_write_file_data(fifo, action);
+      visit_file_data(parser, &operands, parser->visitor->write_file_data);
       break;
     case ALP_OP_RETURN_FILE_DATA:
-      parse_op_return_file_data(fifo, action);
+      visit_file_data(parser, &operands, parser->visitor->return_file_data);
+      break;
+    case ALP_OP_RETURN_FILE_PROPERTIES:
+      visit_return_file_properties(parser, &operands);
       break;
     case ALP_OP_RETURN_TAG:
-      parse_op_return_tag(fifo, action, b6, b7);
+      DPRINT("parsed return tag %i, eop %i, err %i", operands.values[0], b7, b6);
+      if(parser->visitor->return_tag)
+        parser->visitor->return_tag(operands.values[0], b7, b6, parser->arg);
       break;
     case ALP_OP_RETURN_STATUS:
-      parse_op_return_status(fifo, action, b6, b7);
+      visit_return_status(parser, op, &operands);
       break;
     default:
-      DPRINT("op %x not implemented", op);
-      assert(false);
+      DPRINT("op %x skipped", descriptor->op); // not handled by the host
   }
 
-  DPRINT("parsed action");
+  return SUCCESS;
+}
+
+// the coded size of the interface status returned for a forward action, the status of a D7 response contains the
+// addressee of the responder, which is assumed to be a UID
+static uint32_t get_interface_status_length(uint8_t op, operands_t* operands) {
+  uint8_t itf_id = ALP_ITF_ID_D7ASP; // unknown for an indirect forward, so the largest status is assumed
+  if((op & 0x3F) == ALP_OP_FORWARD)
+    copy_view_start(&operands->data, &itf_id, 1);
+
+  switch(itf_id) {
+    case ALP_ITF_ID_D7ASP:
+      return INTERFACE_STATUS_MAX_CODED_SIZE;
+    case ALP_ITF_ID_LORAWAN_ABP:
+    case ALP_ITF_ID_LORAWAN_OTAA:
+      return 1 + 1 + LORAWAN_SESSION_RESULT_CODED_SIZE; // interface ID, length and status
+    default:
+      return 0; // no status
+  }
 }
 
-uint8_t alp_get_expected_response_length(uint8_t* alp_command, uint8_t alp_command_length) {
-  uint8_t expected_response_length = 0;
+uint16_t alp_get_expected_response_length(uint8_t* alp_command, uint8_t alp_command_length) {
+  uint32_t expected_response_length = 0;
   fifo_t fifo;
   fifo_init_filled(&fifo, alp_command, alp_command_length, alp_command_length + 1);
 
   while(fifo_get_size(&fifo) > 0) {
-    alp_control_t control;
-    fifo_pop(&fifo, (uint8_t*)&control.raw, 1);
-    switch(control.operation) {
-      case ALP_OP_READ_FILE_DATA:
-        fifo_skip(&fifo, 1); // skip file ID
-        uint32_t offset = alp_parse_length_operand(&fifo); // offset
-        expected_response_length += alp_parse_length_operand(&fifo); // the file length
-        expected_response_length += alp_length_operand_coded_length(expected_response_length); // the length of the provided data operand
-        expected_response_length += alp_length_operand_coded_length(offset) + 1; // the length of the offset operand
-        expected_response_length += 1; // the opcode
-        break;
-      case ALP_OP_REQUEST_TAG:
-        fifo_skip(&fifo, 1); // skip tag ID operand
-        break;
-      case ALP_OP_RETURN_FILE_DATA:
-      case ALP_OP_WRITE_FILE_DATA:
-        fifo_skip(&fifo, 1); // skip file ID
-        alp_parse_length_operand(&fifo); // offset
-        fifo_skip(&fifo, alp_parse_length_operand(&fifo));
-        break;
-      case ALP_OP_FORWARD: ;
-        uint8_t itf_id;
-        fifo_pop(&fifo, &itf_id, 1);
-        if(itf_id == ALP_ITF_ID_D7ASP) {
-          fifo_skip(&fifo, 1); // skip QoS, dormant timeout
-          d7ap_addressee_ctrl_t addressee_ctrl;
-          fifo_pop(&fifo, (uint8_t*)&addressee_ctrl.raw, 1);
-          fifo_skip(&fifo, 2 + d7ap_addressee_id_length(addressee_ctrl.id_type)); // skip addressee ctrl, access class
-          // TODO refactor to reuse same logic for parsing and response length counting
-        }
-        // other ITFs have no configuration
-        break;
-      case ALP_OP_WRITE_FILE_PROPERTIES:
-        fifo_skip(&fifo, 1 + sizeof(fs_file_header_t)); // skip file ID & header
-        break;
-      // TODO other operations
-      default:
-        DPRINT("op %i not implemented", control.operation);
-        assert(false);
+    uint8_t op;
+    fifo_pop(&fifo, &op, 1);
+    const op_descriptor_t* descriptor = get_descriptor(op);
+    operands_t operands;
+    if(!descriptor || parse_operands(&fifo, op, descriptor, &operands) != SUCCESS) {
+      DPRINT("op %i not implemented", op & 0x3F);
+      assert(false);
+      break;
+    }
+
+    // the modem returns the interface status before the responses to the forwarded actions
+    if(descriptor->response_op == ALP_OP_RETURN_STATUS) {
+      uint32_t status_length = get_interface_status_length(op, &operands);
+      if(status_length > 0)
+        expected_response_length += 1 + status_length;
+
+      continue;
     }
+
+    // the operands of the response are the same as the operands of the request, followed by the data
+    const op_descriptor_t* response_descriptor = get_descriptor(descriptor->response_op);
+    if(descriptor->response_op != ALP_OP_NOP)
+      expected_response_length += get_action_coded_length(response_descriptor, operands.values,
+                                                          get_data_length(response_descriptor, operands.values));
   }
 
   DPRINT("Expected ALP response length=%i", expected_response_length);
-  return expected_response_length;
+  return expected_response_length > UINT16_MAX ? UINT16_MAX : expected_response_length;
 }
 
-void alp_append_tag_request_action(fifo_t* fifo, uint8_t tag_id, bool eop) {
+error_t alp_append_tag_request_action(fifo_t* fifo, uint8_t tag_id, bool eop) {
   DPRINT("append tag %i", tag_id);
-  uint8_t op = ALP_OP_REQUEST_TAG | (eop << 7);
-  assert(fifo_put_byte(fifo, op) == SUCCESS);
-  assert(fifo_put_byte(fifo, tag_id) == SUCCESS);
+  uint32_t values[] = { tag_id };
+  return append_action(fifo, ALP_OP_REQUEST_TAG | (eop << 7), values, NULL, 0);
+}
+
+error_t alp_append_chunk_action(fifo_t* fifo, alp_chunk_step_t step) {
+  return append_action(fifo, ALP_OP_CHUNK | (step << 6), NULL, NULL, 0);
+}
+
+error_t alp_append_read_file_data_action(fifo_t* fifo, uint8_t file_id, uint32_t offset, uint32_t length, bool resp, bool group) {
+  uint32_t values[] = { file_id, offset, length };
+  return append_action(fifo, ALP_OP_READ_FILE_DATA | (resp << 6) | (group << 7), values, NULL, 0);
 }
 
-void alp_append_read_file_data_action(fifo_t* fifo, uint8_t file_id, uint32_t offset, uint32_t length, bool resp, bool group) {
-  uint8_t op = ALP_OP_READ_FILE_DATA | (resp << 6) | (group << 7);
-  assert(fifo_put_byte(fifo, op) == SUCCESS);
-  alp_append_file_offset_operand(fifo, file_id, offset);
-  alp_append_length_operand(fifo, length);
+error_t alp_append_write_file_data_header(fifo_t* fifo, uint8_t file_id, uint32_t offset, uint32_t length, bool resp, bool group) {
+  uint32_t values[] = { file_id, offset, length };
+  return append_action(fifo, ALP_OP_WRITE_FILE_DATA | (resp << 6) | (group << 7), values, NULL, 0);
 }
 
-void alp_append_write_file_data_action(fifo_t* fifo, uint8_t file_id, uint32_t offset, uint32_t length, uint8_t* data, bool resp, bool group) {
-  uint8_t op = ALP_OP_WRITE_FILE_DATA | (resp << 6) | (group << 7);
-  assert(fifo_put_byte(fifo, op) == SUCCESS);
-  alp_append_file_offset_operand(fifo, file_id, offset);
-  alp_append_length_operand(fifo, length);
-  assert(fifo_put(fifo, data, length) == SUCCESS);
+error_t alp_append_write_file_data_action(fifo_t* fifo, uint8_t file_id, uint32_t offset, uint32_t length, uint8_t* data, bool resp, bool group) {
+  uint32_t values[] = { file_id, offset, length };
+  return append_action(fifo, ALP_OP_WRITE_FILE_DATA | (resp << 6) | (group << 7), values, data, length);
 }
 
 uint8_t alp_length_operand_coded_length(uint32_t length) {
@@ -24,26 +24,30 @@
 
 #include "crc.h"
 
-static uint16_t crc;
-
-static void update_crc(uint8_t x)
+static uint16_t update_crc(uint16_t crc, uint8_t x)
 {
      uint16_t crc_new = (uint8_t)(crc >> 8) | (crc << 8);
      crc_new ^= x;
      crc_new ^= (uint8_t)(crc_new & 0xff) >> 4;
      crc_new ^= crc_new << 12;
      crc_new ^= (crc_new & 0xff) << 5;
-     crc = crc_new;
+     return crc_new;
 }
 
 uint16_t crc_calculate(uint8_t* data, uint8_t length)
 {
-    crc = 0xffff;
+    return crc_update(0xffff, data, length);
+}
+
+// no static state, the TX and RX path can calculate a CRC concurrently
+uint16_t crc_update(uint16_t previous_crc, uint8_t* data, uint8_t length)
+{
+    uint16_t crc = previous_crc;
     uint8_t i = 0;
 
     for(; i<length; i++)
     {
-        update_crc(data[i]);
+        crc = update_crc(crc, data[i]);
     }
     return crc;
 }
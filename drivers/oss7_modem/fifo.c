@@ -95,6 +95,24 @@ error_t fifo_put_byte(fifo_t* fifo, uint8_t byte)
     return fifo_put(fifo, &byte, 1);
 }
 
+uint8_t* fifo_reserve(fifo_t* fifo, uint16_t len)
+{
+    if(fifo->is_subview)
+        return NULL;
+
+    uint8_t* ptr = fifo->buffer + fifo->tail_idx;
+    if(fifo->tail_idx < fifo->head_idx)
+    {
+        if(fifo->tail_idx + len >= fifo->head_idx)
+            return NULL;
+    }
+    else if(fifo->tail_idx + len > fifo->max_size)
+        return NULL; // would wrap, the reserved space should be contiguous
+
+    fifo->tail_idx += len;
+    return ptr;
+}
+
 static error_t check_len(fifo_t* fifo, uint16_t len) {
   // quickly bail out if requested length is zero, nothing to do
   if(len == 0) { return SUCCESS; }
@@ -162,6 +180,32 @@ error_t fifo_pop(fifo_t* fifo, uint8_t* buffer, uint16_t len) {
   return SUCCESS;
 }
 
+error_t fifo_pop_view(fifo_t* fifo, fifo_view_t* view, uint16_t len) {
+  error_t err = check_len(fifo, len);
+  if(err != SUCCESS)
+    return err;
+
+  uint16_t start_idx = fifo->head_idx % fifo->max_size;
+  view->part1 = fifo->buffer + start_idx;
+  view->part2 = fifo->buffer;
+  if(start_idx + len <= fifo->max_size) {
+    view->part1_len = len;
+    view->part2_len = 0;
+  } else {
+    view->part1_len = fifo->max_size - start_idx;
+    view->part2_len = len - view->part1_len;
+  }
+
+  skip(fifo, len);
+
+  return SUCCESS;
+}
+
+void fifo_view_copy(const fifo_view_t* view, uint8_t* buffer) {
+  memcpy(buffer, view->part1, view->part1_len);
+  memcpy(buffer + view->part1_len, view->part2, view->part2_len);
+}
+
 uint16_t fifo_get_size(fifo_t* fifo)
 {
     if(fifo->head_idx <= fifo->tail_idx)
@@ -179,3 +223,110 @@ void fifo_clear(fifo_t* fifo)
 bool fifo_is_full(fifo_t* fifo) {
     return fifo_get_size(fifo) == fifo->max_size;
 }
+
+void fifo_pow2_init(fifo_pow2_t* fifo, uint8_t* buffer, uint16_t capacity)
+{
+    assert(capacity > 0 && capacity <= 0x8000 && (capacity & (capacity - 1)) == 0);
+    fifo->buffer = buffer;
+    fifo->head = 0;
+    fifo->tail = 0;
+    fifo->mask = capacity - 1;
+}
+
+void fifo_pow2_init_subview(fifo_t* subset_fifo, fifo_pow2_t* original_fifo, uint16_t offset, uint16_t subset_size)
+{
+    uint16_t capacity = original_fifo->mask + 1;
+    assert(offset + subset_size <= fifo_pow2_get_size(original_fifo));
+    assert(subset_size < capacity); // a full subview can not be distinguished from an empty one
+
+    // the subview wraps at the end of the buffer, so max_size is the full capacity here
+    subset_fifo->buffer = original_fifo->buffer;
+    subset_fifo->head_idx = (original_fifo->head + offset) & original_fifo->mask;
+    subset_fifo->tail_idx = subset_fifo->head_idx + subset_size;
+    if(subset_fifo->tail_idx > capacity)
+      subset_fifo->tail_idx -= capacity; // wrap
+
+    subset_fifo->max_size = capacity;
+    subset_fifo->is_subview = true;
+}
+
+uint16_t fifo_pow2_get_size(fifo_pow2_t* fifo)
+{
+    return (uint16_t)(fifo->tail - fifo->head); // also correct when the counters overflow
+}
+
+bool fifo_pow2_is_full(fifo_pow2_t* fifo)
+{
+    return fifo_pow2_get_size(fifo) > fifo->mask;
+}
+
+// copies len bytes between the buffer, starting at (unmasked) index idx, and data
+static void pow2_copy(fifo_pow2_t* fifo, uint16_t idx, uint8_t* data, uint16_t len, bool to_buffer)
+{
+    uint16_t start_idx = idx & fifo->mask;
+    uint16_t part1 = fifo->mask + 1 - start_idx;
+    if(part1 > len)
+      part1 = len;
+
+    if(to_buffer) {
+      memcpy(fifo->buffer + start_idx, data, part1);
+      memcpy(fifo->buffer, data + part1, len - part1);
+    } else {
+      memcpy(data, fifo->buffer + start_idx, part1);
+      memcpy(data + part1, fifo->buffer, len - part1);
+    }
+}
+
+error_t fifo_pow2_put(fifo_pow2_t* fifo, uint8_t* data, uint16_t len)
+{
+    if(len > fifo->mask + 1 - fifo_pow2_get_size(fifo))
+      return ESIZE;
+
+    pow2_copy(fifo, fifo->tail, data, len, true);
+    fifo->tail += len;
+    return SUCCESS;
+}
+
+error_t fifo_pow2_put_byte(fifo_pow2_t* fifo, uint8_t byte)
+{
+    if(fifo_pow2_is_full(fifo))
+      return ESIZE;
+
+    fifo->buffer[fifo->tail & fifo->mask] = byte;
+    fifo->tail++;
+    return SUCCESS;
+}
+
+error_t fifo_pow2_peek(fifo_pow2_t* fifo, uint8_t* buffer, uint16_t offset, uint16_t len)
+{
+    if(offset + len > fifo_pow2_get_size(fifo))
+      return ESIZE;
+
+    pow2_copy(fifo, fifo->head + offset, buffer, len, false);
+    return SUCCESS;
+}
+
+error_t fifo_pow2_pop(fifo_pow2_t* fifo, uint8_t* buffer, uint16_t len)
+{
+    error_t err = fifo_pow2_peek(fifo, buffer, 0, len);
+    if(err != SUCCESS)
+      return err;
+
+    fifo->head += len;
+    return SUCCESS;
+}
+
+error_t fifo_pow2_skip(fifo_pow2_t* fifo, uint16_t len)
+{
+    if(len > fifo_pow2_get_size(fifo))
+      return ESIZE;
+
+    fifo->head += len;
+    return SUCCESS;
+}
+
+void fifo_pow2_clear(fifo_pow2_t* fifo)
+{
+    fifo->head = 0;
+    fifo->tail = 0;
+}
@@ -44,11 +44,16 @@
 
 #define ALP_PAYLOAD_MAX_SIZE 200 // TODO configurable?
 
+#define ALP_FILE_HEADER_SIZE 12 // coded size of fs_file_header_t
+
+struct fs_file_header; // see fs.h, which depends on alp.h itself
+
 typedef enum
 {
     DASH7,
     LORAWAN_OTAA,
-    lorawan_ABP
+    lorawan_ABP,
+    INTERFACE_FILE // session config stored in an interface file on the modem, referenced by interface_file_id
 } interface_type_t;
 
 typedef struct {
@@ -57,6 +62,7 @@ typedef struct {
         d7ap_session_config_t d7ap_session_config;
         lorawan_session_config_otaa_t lorawan_session_config_otaa;
         lorawan_session_config_abp_t lorawan_session_config_abp;
+        uint8_t interface_file_id;
     };
 } session_config_t;
 
@@ -104,12 +110,24 @@ typedef enum {
     ALP_OP_CHUNK = 48,
     ALP_OP_LOGIC = 49,
     ALP_OP_FORWARD = 50,
+    ALP_OP_INDIRECT_FORWARD = 51,
     ALP_OP_REQUEST_TAG = 52
 } alp_operation_t;
 
+// the chunk step, coded in b7 and b6 of the chunk action
+typedef enum {
+    ALP_CHUNK_STEP_CONTINUE = 0,
+    ALP_CHUNK_STEP_START = 1,
+    ALP_CHUNK_STEP_END = 2,
+    ALP_CHUNK_STEP_START_END = 3
+} alp_chunk_step_t;
+
 // define the (max) size for all ALP operation types
+#define ALP_OP_SIZE_CHUNK 1
 #define ALP_OP_SIZE_REQUEST_TAG (1 + 1)
 #define ALP_OP_SIZE_READ_FILE_DATA (1 + 5 + 4)
+#define ALP_OP_SIZE_FILE_PROPERTIES (1 + 1 + ALP_FILE_HEADER_SIZE)
+#define ALP_OP_SIZE_QUERY (1 + 1 + 1 + 4 + 2 * 4 + 5) // opcode, query code, compare length, mask, 2 values and file offset
 
 typedef enum {
   ALP_STATUS_OK = 0x00,
@@ -131,6 +149,21 @@ typedef enum {
   ARITH_COMP_TYPE_GREATER_THAN_OR_EQUAL_TO = 5
 } alp_query_arithmetic_comparison_type_t;
 
+typedef enum {
+  QUERY_CODE_TYPE_NON_VOID = 0,
+  QUERY_CODE_TYPE_ARITH_COMP_WITH_ZERO = 1,
+  QUERY_CODE_TYPE_ARITH_COMP_WITH_VALUE = 2,
+  QUERY_CODE_TYPE_ARITH_COMP_BETWEEN_FILES = 3,
+  QUERY_CODE_TYPE_RANGE_COMP = 4,
+  QUERY_CODE_TYPE_STRING_TOKEN = 7
+} alp_query_code_type_t;
+
+typedef enum {
+  RANGE_COMP_TYPE_NOT_IN_RANGE = 0,
+  RANGE_COMP_TYPE_IN_RANGE = 1
+} alp_query_range_comparison_type_t;
+
+
 /*! \brief The ALP CTRL header
  *
  * note: bit order is important here since this is send over the air. We explicitly reverse the order to ensure BE.
@@ -192,6 +225,19 @@ typedef struct {
     uint32_t offset;
 } alp_operand_file_offset_t;
 
+/*! \brief A query comparing (big endian) file data with a value or a range, see alp_init_arithmetic_query() and alp_init_range_query()
+ */
+typedef struct {
+    alp_query_code_type_t type; // only QUERY_CODE_TYPE_ARITH_COMP_WITH_VALUE and QUERY_CODE_TYPE_RANGE_COMP are supported
+    uint8_t comparison_type; // alp_query_arithmetic_comparison_type_t or alp_query_range_comparison_type_t
+    bool is_signed;
+    uint8_t compare_length; // number of bytes of file data compared, 1 to 4
+    uint32_t mask; // applied to the file data before comparing, 0 means no mask. Only used for arithmetic comparisons
+    uint32_t value; // the compared value, or the lower boundary of the range
+    uint32_t max_value; // the upper boundary of the range
+    alp_operand_file_offset_t file_offset;
+} alp_query_t;
+
 typedef struct {
     alp_operand_file_offset_t file_offset;
     uint32_t requested_data_length;
@@ -200,28 +246,43 @@ typedef struct {
 typedef struct {
     alp_operand_file_offset_t file_offset;
     uint32_t provided_data_length;
-    uint8_t data[255]; // TODO fixed size?
+    fifo_view_t data; // points in the parsed fifo, only valid until the parsed bytes are overwritten
 } alp_operand_file_data_t;
 
 typedef struct {
-    uint8_t data[255];
-    uint8_t len;
-} alp_interface_status_t;
-
+    uint8_t file_id;
+    uint8_t file_header[ALP_FILE_HEADER_SIZE]; // as coded, use alp_decode_file_header()
+} alp_operand_file_header_t;
 
 typedef struct {
-    alp_operation_t operation;
+    uint8_t itf_id;
     union {
-        alp_operand_file_data_t file_data_operand;
-        struct {
-            bool completed;
-            bool error;
-            uint8_t tag_id;
-        } tag_response;
-        alp_interface_status_t status;
+        d7ap_session_result_t d7ap_session_result; // when itf_id == ALP_ITF_ID_D7ASP
+        lorawan_session_result_t lorawan_session_result; // when itf_id == ALP_ITF_ID_LORAWAN_ABP or ALP_ITF_ID_LORAWAN_OTAA
     };
+} alp_interface_status_t;
+
 
-} alp_action_t;
+/*! \brief Callbacks for the actions found by alp_parser_next(). A NULL callback means the action is skipped without decoding,
+ *  which is also the case for all other actions.
+ *  The fixed fields are decoded, variable length data is passed as a view on the parsed fifo and is only valid during the callback.
+ */
+typedef struct {
+    void (*return_tag)(uint8_t tag_id, bool completed, bool error, void* arg);
+    void (*write_file_data)(alp_operand_file_data_t* operand, void* arg);
+    void (*return_file_data)(alp_operand_file_data_t* operand, void* arg);
+    void (*return_file_properties)(alp_operand_file_header_t* operand, void* arg);
+    void (*return_status)(alp_interface_status_t* status, void* arg); // the status is zeroed for unknown interfaces
+    void (*action_status)(uint8_t action_index, alp_status_codes_t status, void* arg);
+} alp_visitor_t;
+
+/*! \brief The state of a parser, which parses the actions in a fifo one by one
+ */
+typedef struct {
+    fifo_t* fifo; // the actions which are not parsed yet
+    const alp_visitor_t* visitor;
+    void* arg; // passed to the callbacks
+} alp_parser_t;
 
 /*!
  * \brief Returns the ALP operation type contained in alp_command
@@ -231,19 +292,61 @@ typedef struct {
 alp_operation_t alp_get_operation(uint8_t* alp_command);
 
 
-uint8_t alp_get_expected_response_length(uint8_t* alp_command, uint8_t alp_command_length);
-
-void alp_append_tag_request_action(fifo_t* fifo, uint8_t tag_id, bool eop);
-void alp_append_read_file_data_action(fifo_t* fifo, uint8_t file_id, uint32_t offset, uint32_t length, bool resp, bool group);
-void alp_append_write_file_data_action(fifo_t* fifo, uint8_t file_id, uint32_t offset, uint32_t length, uint8_t* data, bool resp, bool group);
-void alp_append_forward_action(fifo_t* fifo, uint8_t itf_id, uint8_t *config, uint8_t config_len);
-void alp_append_return_file_data_action(fifo_t* fifo, uint8_t file_id, uint32_t offset, uint32_t length, uint8_t* data);
-void alp_append_length_operand(fifo_t* fifo, uint32_t length);
+// the size of the response to alp_command, for forwarded commands the size of the response of one responder
+uint16_t alp_get_expected_response_length(uint8_t* alp_command, uint8_t alp_command_length);
+
+// The alp_append_* functions append a complete action or operand, or nothing at all when it does not fit in fifo.
+// They return SUCCESS, or ESIZE when there is not enough (contiguous) space left.
+error_t alp_append_tag_request_action(fifo_t* fifo, uint8_t tag_id, bool eop);
+// marks the frame as (a part of) a command which is split over multiple frames
+error_t alp_append_chunk_action(fifo_t* fifo, alp_chunk_step_t step);
+error_t alp_append_read_file_data_action(fifo_t* fifo, uint8_t file_id, uint32_t offset, uint32_t length, bool resp, bool group);
+error_t alp_append_write_file_data_action(fifo_t* fifo, uint8_t file_id, uint32_t offset, uint32_t length, uint8_t* data, bool resp, bool group);
+// appends a write file data action without the data itself, the caller is responsible for appending length bytes afterwards
+error_t alp_append_write_file_data_header(fifo_t* fifo, uint8_t file_id, uint32_t offset, uint32_t length, bool resp, bool group);
+error_t alp_append_forward_action(fifo_t* fifo, uint8_t itf_id, uint8_t *config, uint8_t config_len);
+// forward using the interface configuration stored in a file on the modem, see alp_append_interface_config()
+error_t alp_append_indirect_forward_action(fifo_t* fifo, uint8_t interface_file_id);
+// appends the interface ID and configuration, as used in a forward action or stored in an interface file
+error_t alp_append_interface_config(fifo_t* fifo, uint8_t itf_id, uint8_t *config, uint8_t config_len);
+// the number of bytes appended by alp_append_interface_config()
+uint8_t alp_interface_config_coded_length(uint8_t itf_id, uint8_t *config, uint8_t config_len);
+error_t alp_append_return_file_data_action(fifo_t* fifo, uint8_t file_id, uint32_t offset, uint32_t length, uint8_t* data);
+// appends a return file data action without the data itself, the caller is responsible for appending length bytes afterwards
+error_t alp_append_return_file_data_header(fifo_t* fifo, uint8_t file_id, uint32_t offset, uint32_t length);
+error_t alp_append_length_operand(fifo_t* fifo, uint32_t length);
+
+error_t alp_append_read_file_properties_action(fifo_t* fifo, uint8_t file_id, bool resp, bool group);
+error_t alp_append_write_file_properties_action(fifo_t* fifo, uint8_t file_id, const struct fs_file_header* file_header, bool resp, bool group);
+void alp_decode_file_header(const uint8_t* coded_file_header, struct fs_file_header* file_header);
+
+void alp_init_arithmetic_query(alp_query_t* query, uint8_t file_id, uint32_t offset, uint8_t compare_length,
+                               alp_query_arithmetic_comparison_type_t comparison_type, bool is_signed, uint32_t value);
+void alp_init_range_query(alp_query_t* query, uint8_t file_id, uint32_t offset, uint8_t compare_length,
+                          alp_query_range_comparison_type_t comparison_type, bool is_signed, uint32_t min_value, uint32_t max_value);
+// the actions following an action query are only executed when the query matches
+error_t alp_append_action_query_action(fifo_t* fifo, const alp_query_t* query);
+// the processing of the command stops when a break query does not match
+error_t alp_append_break_query_action(fifo_t* fifo, const alp_query_t* query);
 
 uint32_t alp_parse_length_operand(fifo_t* cmd_fifo);
 alp_operand_file_offset_t alp_parse_file_offset_operand(fifo_t* cmd_fifo);
 
-void alp_parse_action(fifo_t* fifo, alp_action_t* action);
+/*! \brief Starts parsing the actions in fifo, the parsed bytes are popped from fifo by alp_parser_next()
+ */
+void alp_parser_init(alp_parser_t* parser, fifo_t* fifo, const alp_visitor_t* visitor, void* arg);
+
+/*! \brief Parses the next action and calls the matching visitor callback. The parser can be resumed later, for example to
+ *  interleave the parsing of a frame containing many actions with other work. All operations of alp_operation_t are
+ *  parsed, and statuses of unknown interfaces are skipped using their length.
+ *  \return SUCCESS, ESIZE when the action is truncated or EINVAL when the operation is unknown or a permission request.
+ *  In both error cases the start of the next action is unknown, so the remaining bytes are skipped.
+ */
+error_t alp_parser_next(alp_parser_t* parser);
+
+/*! \brief Returns true when all actions are parsed
+ */
+bool alp_parser_done(alp_parser_t* parser);
 
 uint8_t alp_length_operand_coded_length(uint32_t length);
 
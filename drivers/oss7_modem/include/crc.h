@@ -35,6 +35,9 @@
 
 uint16_t crc_calculate(uint8_t* data, uint8_t length);
 
+/*! \brief Continues a CRC calculation (started with crc_calculate()) over more data */
+uint16_t crc_update(uint16_t previous_crc, uint8_t* data, uint8_t length);
+
 #endif /* CRC_H_ */
 
 /** @}*/
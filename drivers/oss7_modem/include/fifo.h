@@ -44,6 +44,19 @@ typedef struct {
     bool is_subview;
 } fifo_t;
 
+/**
+ * @brief A zero-copy view on (part of) the FIFO contents.
+ *
+ * Since the data can wrap around the end of the circular buffer it is described by (at most) two contiguous parts.
+ * The view points directly in the FIFO's buffer, so it is only valid as long as the viewed bytes are not overwritten.
+ **/
+typedef struct {
+    uint8_t* part1;         /**< Pointer to the first contiguous part */
+    uint16_t part1_len;     /**< Length of the first part */
+    uint8_t* part2;         /**< Pointer to the wrapped part, at the start of the buffer (only valid when part2_len > 0) */
+    uint16_t part2_len;     /**< Length of the wrapped part, 0 when the data does not wrap */
+} fifo_view_t;
+
 /**
  * @brief Initializes the fifo.
  * @param fifo          Fifo state, initialized by this function
@@ -88,6 +101,16 @@ error_t fifo_put(fifo_t* fifo, uint8_t* data, uint16_t len);
  */
 error_t fifo_put_byte(fifo_t* fifo, uint8_t byte);
 
+/**
+ * @brief Reserves len contiguous bytes at the tail of the FIFO, which the caller fills directly instead of copying them in
+ * using fifo_put(). The reserved bytes are part of the FIFO contents as soon as this function returns.
+ * @param fifo  Pointer to the fifo object
+ * @param len   Number of bytes to reserve
+ * @returns Pointer to the reserved bytes, or NULL when there is not enough contiguous space left (without wrapping) or
+ * when fifo is a subview
+ */
+uint8_t* fifo_reserve(fifo_t* fifo, uint16_t len);
+
 /**
  * @brief Peek at the FIFO contents without popping. Fills buffer with the data in the FIFO starting from head_idx + offset for len bytes
  * @param fifo      Pointer to the fifo object
@@ -107,6 +130,22 @@ error_t fifo_peek(fifo_t* fifo, uint8_t* buffer, uint16_t offset, uint16_t len);
  */
 error_t fifo_pop(fifo_t* fifo, uint8_t* buffer, uint16_t len);
 
+/**
+ * @brief Pop bytes from the FIFO without copying, the popped data is described by a view on the FIFO's buffer instead
+ * @param fifo      Pointer to the fifo object
+ * @param view      The view, filled by this function
+ * @param len       number of bytes to pop
+ * @returns SUCCESS or ESIZE if len > current size or when FIFO empty
+ */
+error_t fifo_pop_view(fifo_t* fifo, fifo_view_t* view, uint16_t len);
+
+/**
+ * @brief Copies the data described by a view in to a contiguous buffer
+ * @param view      Pointer to the view
+ * @param buffer    Buffer of at least part1_len + part2_len bytes
+ */
+void fifo_view_copy(const fifo_view_t* view, uint8_t* buffer);
+
 /**
  * @brief Skips bytes from the FIFO
  * @param fifo      Pointer to the fifo object
@@ -135,6 +174,101 @@ uint16_t fifo_get_size(fifo_t* fifo);
  */
 bool fifo_is_full(fifo_t* fifo);
 
+/**
+ * @brief FIFO state for a buffer with a power-of-two capacity.
+ *
+ * head and tail are free running counters which are only masked when indexing the buffer, so the wrap is branch free and
+ * the full capacity can be used. The RX ISR only moves the tail and the consumer only moves the head.
+ **/
+typedef struct {
+    uint16_t head;          /**< Free running read counter */
+    uint16_t tail;          /**< Free running write counter */
+    uint16_t mask;          /**< Capacity - 1, used to map the counters on the buffer */
+    uint8_t* buffer;        /**< The buffer where the data is stored */
+} fifo_pow2_t;
+
+/**
+ * @brief Initializes the power-of-two fifo.
+ * @param fifo          Fifo state, initialized by this function
+ * @param buffer        The buffer used for the fifo
+ * @param capacity      The size of buffer, which must be a power of two and at most 32768
+ */
+void fifo_pow2_init(fifo_pow2_t* fifo, uint8_t* buffer, uint16_t capacity);
+
+/**
+ * @brief Initializes a fifo_t subview on the contents of a power-of-two fifo, starting from the original's head.
+ * The same rules as for fifo_init_subview() apply, this allows consumers of fifo_t (like the ALP parser) to read from it.
+ * @param subview_fifo  The fifo containing the subset
+ * @param original_fifo The original fifo
+ * @param offset        The offset index in original fifo which will be used as the subset's head (starting from original_fifo's head)
+ * @param subset_size   The size of the subset (must be smaller than the capacity of original_fifo)
+ */
+void fifo_pow2_init_subview(fifo_t* subview_fifo, fifo_pow2_t* original_fifo, uint16_t offset, uint16_t subset_size);
+
+/**
+ * @brief Put bytes in to the power-of-two FIFO
+ * @param fifo  Pointer to the fifo object
+ * @param data  Pointer to the data to be put in the FIFO
+ * @param len   Number of bytes to put in the FIFO
+ * @returns SUCCESS or ESIZE when data would overwrite head of FIFO
+ */
+error_t fifo_pow2_put(fifo_pow2_t* fifo, uint8_t* data, uint16_t len);
+
+/**
+ * @brief Put byte in to the power-of-two FIFO
+ * @param fifo  Pointer to the fifo object
+ * @param byte  Byte to be put in the FIFO
+ * @returns SUCCESS or ESIZE when the FIFO is full
+ */
+error_t fifo_pow2_put_byte(fifo_pow2_t* fifo, uint8_t byte);
+
+/**
+ * @brief Peek at the power-of-two FIFO contents without popping
+ * @param fifo      Pointer to the fifo object
+ * @param buffer    buffer to be filled
+ * @param offset    offset starting from head
+ * @param len       length in number of bytes to read
+ * @returns SUCCESS or ESIZE when offset + len > current size
+ */
+error_t fifo_pow2_peek(fifo_pow2_t* fifo, uint8_t* buffer, uint16_t offset, uint16_t len);
+
+/**
+ * @brief Read and pop bytes from the power-of-two FIFO
+ * @param fifo      Pointer to the fifo object
+ * @param buffer    Pointer to buffer where the first len bytes of FIFO can be copied to
+ * @param len       number of bytes to read/pop
+ * @returns SUCCESS or ESIZE if len > current size
+ */
+error_t fifo_pow2_pop(fifo_pow2_t* fifo, uint8_t* buffer, uint16_t len);
+
+/**
+ * @brief Skips bytes from the power-of-two FIFO
+ * @param fifo      Pointer to the fifo object
+ * @param len       number of bytes to skip
+ * @returns SUCCESS or ESIZE if len > current size
+ */
+error_t fifo_pow2_skip(fifo_pow2_t* fifo, uint16_t len);
+
+/**
+ * @brief Clears the power-of-two FIFO
+ * @param fifo      Pointer to the fifo object
+ */
+void fifo_pow2_clear(fifo_pow2_t* fifo);
+
+/**
+ * @brief Returns the number of bytes currently in the power-of-two FIFO
+ * @param fifo      Pointer to the fifo object
+ * @return Number of bytes currently in the FIFO
+ */
+uint16_t fifo_pow2_get_size(fifo_pow2_t* fifo);
+
+/**
+ * @brief Returns if the power-of-two FIFO is completely full
+ * @param fifo      Pointer to the fifo object
+ * @return Flag indicating if FIFO is full
+ */
+bool fifo_pow2_is_full(fifo_pow2_t* fifo);
+
 #endif // FIFO_H
 
 /** @}*/
@@ -52,7 +52,7 @@ typedef struct __attribute__((__packed__))
     bool action_protocol_enabled : 1;
 } fs_file_properties_t;
 
-typedef struct __attribute__((__packed__))
+typedef struct __attribute__((__packed__)) fs_file_header
 {
     uint8_t file_permissions; // TODO not used for now
     fs_file_properties_t file_properties;
@@ -44,6 +44,12 @@ typedef enum {
   OTAA,
 } activationMethod_t;
 
+typedef struct {
+    uint8_t attempts;
+    lorawan_stack_error_t error_state;
+    uint16_t duty_cycle_wait_time;
+} lorawan_session_result_t;
+
 
 
 typedef struct {
@@ -22,20 +22,55 @@
 #include "d7ap.h"
 #include "alp.h"
 #include "lorawan_stack.h"
+#include "fs.h"
+#include "sample_codec.h"
 #include "periph/uart.h"
+#include "periph/gpio.h"
+#include "mutex.h"
+#include "xtimer.h"
+
+#ifdef MODEM_USE_EVENT_QUEUE
+#include "event.h"
+#endif
 
 
 // TODO for now we are assuming running on OSS-7, we can refactor later
 // so it is more portable
 
+// the output_buffer passed to the file data callbacks is only valid for the duration of the callback
 typedef void (*modem_command_completed_callback_t)(bool with_error);
 typedef void (*modem_return_file_data_callback_t)(uint8_t file_id, uint32_t offset, uint32_t size, uint8_t* output_buffer);
 typedef void (*modem_write_file_data_callback_t)(uint8_t file_id, uint32_t offset, uint32_t size, uint8_t* output_buffer);
+// called for every interface status received (one per responder), before the file data of the response
+typedef void (*modem_link_status_callback_t)(d7ap_session_result_t* result);
+
+// the status and file data returned by one responder
+typedef struct {
+    d7ap_session_result_t status;
+    uint8_t file_id;
+    uint32_t offset;
+    uint8_t length;
+    uint8_t* data;
+} modem_response_t;
+
+// called for every responder to a command started with modem_collect_file_async(), response->data is only valid during the callback.
+// The link status callback is called with the same status right after.
+typedef void (*modem_response_callback_t)(modem_response_t* response);
+// called when the watchdog declares the modem dead, or alive again
+typedef void (*modem_health_callback_t)(bool alive);
+
+// streaming transfers: the sink receives consecutive parts of the file (offset is relative to the start of the transfer),
+// and returns false to abort. The source should fill buffer with length bytes of the file.
+typedef bool (*modem_transfer_sink_t)(uint32_t offset, uint8_t* data, uint8_t length, void* arg);
+typedef void (*modem_transfer_source_t)(uint32_t offset, uint8_t* buffer, uint8_t length, void* arg);
 
 typedef struct {
     modem_command_completed_callback_t command_completed_callback;
     modem_return_file_data_callback_t return_file_data_callback;
     modem_write_file_data_callback_t write_file_data_callback;
+    modem_link_status_callback_t link_status_callback;
+    modem_response_callback_t response_callback;
+    modem_health_callback_t health_callback;
 } modem_callbacks_t;
 
 typedef enum {
@@ -43,18 +78,420 @@ typedef enum {
     MODEM_STATUS_COMMAND_TIMEOUT,
     MODEM_STATUS_COMMAND_COMPLETED_SUCCESS,
     MODEM_STATUS_COMMAND_COMPLETED_ERROR,
-    MODEM_STATUS_COMMAND_PROCESSING
+    MODEM_STATUS_COMMAND_PROCESSING,
+    MODEM_STATUS_COMMAND_TOO_LARGE,
+    MODEM_STATUS_COMMAND_CANCELLED,
+    MODEM_STATUS_DUTY_CYCLE_LIMITED, // the duty cycle limits of the interface do not allow a transmission now
+    MODEM_STATUS_WOULD_BLOCK, // a sync function was called from the thread handling the modem events
+    MODEM_STATUS_NOT_RETURNED // the command completed successfully, but the requested data was not returned
 } modem_status_t;
 
+// priority class of a command, see modem_batch_start_prio() and modem_set_thread_priority()
+typedef enum {
+    MODEM_PRIORITY_NORMAL = 0, // default
+    MODEM_PRIORITY_URGENT = 1, // served before all other waiting commands
+    MODEM_PRIORITY_BULK = 2,   // served after all other waiting commands
+    MODEM_PRIORITY_COUNT,
+    MODEM_PRIORITY_DEFAULT = MODEM_PRIORITY_COUNT // the class set for the calling thread, MODEM_PRIORITY_NORMAL when not set
+} modem_priority_t;
+
+#ifndef MODEM_PRIORITY_THREADS
+#define MODEM_PRIORITY_THREADS 4 // max number of threads for which modem_set_thread_priority() sets a default class
+#endif
+
+typedef struct {
+    uint32_t commands;          // number of commands which got the command slot
+    uint32_t waited;            // number of commands which had to wait for the slot
+    uint32_t timeouts;          // number of commands which did not get the slot in time (MODEM_STATUS_BUSY)
+    uint32_t cancelled;         // number of commands cancelled in favour of an urgent command
+    uint32_t max_wait_us;       // max queueing delay
+    uint64_t total_wait_us;     // divide by commands for the average queueing delay, includes the wait on the modem
+                                // for a cancelled bulk command
+} modem_priority_stats_t;
+
+#define MODEM_PREPARED_COMMAND_HEADER_SIZE 64 // tag request, forward action (max 44 bytes for LoRaWAN ABP) and return file data header
+
+// a pre-encoded command, of which only the tag and payload change on every send
+typedef struct {
+    uint8_t header[MODEM_PREPARED_COMMAND_HEADER_SIZE];
+    uint8_t header_length;
+    uint8_t data_length;
+    bool has_target_uid;
+    uint8_t target_uid[D7A_FILE_UID_SIZE];
+    uint8_t airtime_bucket;
+    uint32_t airtime_us;
+    uint8_t trace_itf;
+    modem_priority_t priority; // MODEM_PRIORITY_DEFAULT after preparing, can be changed before sending
+} modem_prepared_command_t;
+
+typedef struct {
+    uint8_t file_id;
+    uint32_t offset;
+    uint32_t size;
+    uint8_t* buffer; // filled with the file data, should be at least size bytes
+} modem_read_req_t;
+
+typedef enum {
+    MODEM_CACHE_POLICY_UNCACHED = 0,     // always read from the modem (default)
+    MODEM_CACHE_POLICY_IMMUTABLE = 1,    // file does not change, cached reads are only invalidated by writes
+    MODEM_CACHE_POLICY_WRITE_THROUGH = 2 // our writes update the cached data, writes pushed by the modem invalidate it
+} modem_cache_policy_t;
+
+// link quality statistics of a D7 peer
+typedef struct {
+    uint8_t uid[D7A_FILE_UID_SIZE];
+    uint8_t rx_level;           // of the last response
+    uint8_t link_budget;        // of the last response
+    uint8_t avg_rx_level;       // rolling average
+    uint8_t avg_link_budget;    // rolling average
+    uint32_t last_seen;         // uptime in seconds
+    uint16_t requests;          // number of requests unicasted to this peer
+    uint16_t responses;         // number of responses received from this peer, divide by requests for the success rate
+} modem_link_status_t;
+
+typedef struct {
+    uint16_t queue_depth;       // number of events currently queued
+    uint16_t max_queue_depth;   // high-water mark of queue_depth
+    uint32_t dispatched;        // number of events handled
+    uint32_t dropped;           // number of events dropped because the queue was full
+    uint32_t max_latency_us;    // max time between queueing and handling an event
+    uint64_t total_latency_us;  // divide by dispatched for the average latency
+} modem_dispatch_stats_t;
+
+#ifndef MODEM_COLLECTOR_INDEX_SIZE
+#define MODEM_COLLECTOR_INDEX_SIZE 64 // should be a power of 2, and larger than the max number of responses
+#endif
+
+// Collects the responses of all responders to one command, in user supplied storage.
+// Responses are indexed by the addressee ID of the responder, a node which responds multiple times only occupies one entry.
+typedef struct {
+    modem_response_t* responses;
+    uint8_t max_responses;
+    uint8_t count;
+    uint8_t* data_pool; // the data of the responses is stored here
+    uint16_t data_pool_size;
+    uint16_t data_pool_used;
+    uint16_t dropped; // number of responses which did not fit
+    modem_response_t* current; // responder of the last received status, waiting for file data
+    uint8_t index[MODEM_COLLECTOR_INDEX_SIZE]; // open addressing hash table, containing indexes in responses
+} modem_response_collector_t;
+
+#ifndef MODEM_MIRROR_MAX_RANGES
+#define MODEM_MIRROR_MAX_RANGES 4 // max number of dirty ranges tracked, more ranges are merged
+#endif
+
+#ifndef MODEM_MIRROR_MERGE_GAP
+#define MODEM_MIRROR_MERGE_GAP 4 // dirty ranges separated by less bytes are merged, since every write action has about 4 bytes overhead
+#endif
+
+#ifndef MODEM_MIRROR_MAX_WRITE_SIZE
+#define MODEM_MIRROR_MAX_WRITE_SIZE 200 // larger ranges are split in multiple write actions
+#endif
+
+typedef struct {
+    uint16_t start;
+    uint16_t end; // exclusive
+} modem_mirror_range_t;
+
+// A host buffer mirroring a (local) modem file. Only the changed parts are written to the modem on sync.
+typedef struct {
+    uint8_t file_id;
+    uint8_t* buffer;
+    uint16_t size;
+    uint8_t range_count;
+    modem_mirror_range_t dirty[MODEM_MIRROR_MAX_RANGES + 1]; // sorted on start, one extra for inserting a new range
+} modem_mirror_t;
+
+#ifndef MODEM_UPLINK_QUEUE_SIZE
+#define MODEM_UPLINK_QUEUE_SIZE 8
+#endif
+
+#ifndef MODEM_UPLINK_MAX_DATA_SIZE
+#define MODEM_UPLINK_MAX_DATA_SIZE 32
+#endif
+
+typedef enum {
+    MODEM_UPLINK_DROP_OLDEST, // when the queue is full the oldest uplink is dropped
+    MODEM_UPLINK_DROP_NEWEST, // when the queue is full new uplinks are rejected
+    MODEM_UPLINK_COALESCE     // a new uplink replaces a queued uplink for the same file, otherwise drops the oldest
+} modem_uplink_drop_policy_t;
+
+typedef struct {
+    uint32_t seqnr; // increasing, used to restore the order after a reboot
+    uint8_t file_id;
+    uint8_t priority; // modem_priority_t of the command sending the uplink
+    uint8_t length;
+    uint32_t offset;
+    uint8_t data[MODEM_UPLINK_MAX_DATA_SIZE];
+} modem_uplink_t;
+
+// Optional persistent storage (for example flash or MTD) of the uplink queue, one slot per queue entry
+typedef struct {
+    bool (*read_slot)(uint8_t slot, modem_uplink_t* uplink); // should return false when the slot is empty
+    void (*write_slot)(uint8_t slot, const modem_uplink_t* uplink); // uplink is NULL to erase the slot
+} modem_uplink_storage_t;
+
+typedef struct {
+    uint8_t queued;     // number of uplinks currently queued
+    uint32_t sent;
+    uint32_t dropped;   // number of uplinks lost because the queue was full
+    uint32_t coalesced; // number of uplinks replaced by newer data
+    uint32_t retries;   // number of failed attempts
+} modem_uplink_stats_t;
+
+#ifndef MODEM_TRACE_SIZE
+#define MODEM_TRACE_SIZE 16 // number of most recent commands kept in the trace
+#endif
+
+#ifndef MODEM_TRACE_HISTOGRAM_BUCKETS
+#define MODEM_TRACE_HISTOGRAM_BUCKETS 16
+#endif
+
+// bucket 0 contains durations below 2^(MODEM_TRACE_HISTOGRAM_BASE_LOG2 + 1) us, bucket i durations in
+// [2^(MODEM_TRACE_HISTOGRAM_BASE_LOG2 + i), 2^(MODEM_TRACE_HISTOGRAM_BASE_LOG2 + i + 1)) us, the last bucket everything above
+#ifndef MODEM_TRACE_HISTOGRAM_BASE_LOG2
+#define MODEM_TRACE_HISTOGRAM_BASE_LOG2 8
+#endif
+
+typedef enum {
+    MODEM_TRACE_SUBMIT,     // command started, before waiting for the command slot
+    MODEM_TRACE_TX_START,   // first byte written to the UART
+    MODEM_TRACE_TX_END,     // last byte written to the UART
+    MODEM_TRACE_RX_START,   // first byte received of the frame containing the completed tag
+    MODEM_TRACE_TAG_PARSED,
+    MODEM_TRACE_DELIVERED,  // sync caller woken up, or completion callback executed
+    MODEM_TRACE_TIMESTAMP_COUNT
+} modem_trace_timestamp_t;
+
+typedef enum {
+    MODEM_TRACE_PHASE_QUEUE,    // submit until TX start: waiting for the command slot and encoding
+    MODEM_TRACE_PHASE_UART_TX,  // TX start until TX end
+    MODEM_TRACE_PHASE_MODEM,    // TX end until RX start: executed by the modem, including the time on air
+    MODEM_TRACE_PHASE_UART_RX,  // RX start until tag parsed: receiving and parsing the response, includes RX thread latency
+    MODEM_TRACE_PHASE_DELIVERY, // tag parsed until delivered
+    MODEM_TRACE_PHASE_TOTAL,    // submit until delivered
+    MODEM_TRACE_PHASE_COUNT
+} modem_trace_phase_t;
+
+typedef enum {
+    MODEM_TRACE_ITF_LOCAL, // executed on the modem itself
+    MODEM_TRACE_ITF_D7,
+    MODEM_TRACE_ITF_LORAWAN,
+    MODEM_TRACE_ITF_FILE,  // forwarded using an interface file, the interface is unknown on the host
+    MODEM_TRACE_ITF_COUNT
+} modem_trace_itf_t;
+
+typedef struct {
+    uint8_t tag_id;
+    uint8_t itf; // modem_trace_itf_t
+    bool completed; // false when the command timed out or was cancelled
+    bool cancelled;
+    bool with_error;
+    uint32_t timestamps[MODEM_TRACE_TIMESTAMP_COUNT]; // xtimer_now_usec(), 0 when not reached
+} modem_trace_record_t;
+
+typedef struct {
+    bool alive;
+    uint8_t consecutive_misses;
+    uint32_t pings;       // number of pings sent, the modem is not pinged when other frames were received
+    uint32_t misses;      // number of unanswered pings
+    uint32_t recoveries;  // number of times the modem was declared dead and reinitialized
+    uint32_t last_rtt_us;
+    uint32_t avg_rtt_us;
+    uint32_t max_rtt_us;
+} modem_health_t;
+
+// frames of the sample batch are sent through the uplink queue by default, so should fit in an uplink
+#ifndef MODEM_SAMPLE_BATCH_MAX_SIZE
+#define MODEM_SAMPLE_BATCH_MAX_SIZE MODEM_UPLINK_MAX_DATA_SIZE
+#endif
+
+// sends a frame of the sample batch, should return false when the frame is lost
+typedef bool (*modem_sample_batch_flush_t)(uint8_t file_id, uint8_t* frame, uint8_t length);
+
+typedef struct modem_sample_batch {
+    uint8_t file_id;
+    modem_sample_batch_flush_t flush;
+    uint8_t max_samples;
+    uint32_t max_age_ms;
+    sample_codec_header_t header;
+    uint8_t header_length;
+    uint8_t length; // of the frame, including the header
+    int32_t last_sample;
+    xtimer_t age_timer; // started when the first sample is added to the frame
+    volatile bool expired;
+    modem_priority_t priority; // of the uplinks, when no flush function is used. MODEM_PRIORITY_DEFAULT after init
+    mutex_t mutex; // the frame is flushed by the dispatch worker when it expires
+    struct modem_sample_batch* next; // in the list of batches checked by the worker
+    uint8_t frame[MODEM_SAMPLE_BATCH_MAX_SIZE];
+} modem_sample_batch_t;
+
+#ifdef MODEM_USE_EVENT_QUEUE
+// The received frames are parsed and the callbacks are executed from this queue, instead of from dedicated threads.
+// Should be called before modem_init(). The thread running the event loop should only use the async functions, and is
+// notified of the completion by the command_completed_callback. The sync functions return MODEM_STATUS_WOULD_BLOCK when
+// called from this thread, and can still be used from other threads.
+void modem_set_event_queue(event_queue_t* queue);
+#endif
+
 void modem_init(uint8_t uart_idx, uint32_t baudrate);
 void modem_cb_init(modem_callbacks_t* cbs);
 modem_status_t modem_read_file(uint8_t file_id, uint32_t offset, uint32_t size, uint8_t* response_buffer);
+// Returns MODEM_STATUS_NOT_RETURNED when the modem did not return (all) the data of a request, the buffer of that request
+// is not (completely) initialized then.
+modem_status_t modem_read_files(const modem_read_req_t* reqs, uint8_t count);
 modem_status_t modem_write_file(uint8_t file_id, uint32_t offset, uint32_t size, uint8_t* data);
+// async commands complete with an error when the modem does not respond within 30 s
 modem_status_t modem_read_file_async(uint8_t file_id, uint32_t offset, uint32_t size);
 modem_status_t modem_write_file_async(uint8_t file_id, uint32_t offset, uint32_t size, uint8_t* data);
 modem_status_t modem_send_unsolicited_response(uint8_t file_id, uint32_t offset, uint32_t length, uint8_t* data, session_config_t* session_config);
 modem_status_t modem_send_unsolicited_response_async(uint8_t file_id, uint32_t offset, uint32_t length, uint8_t* data, session_config_t* session_config);
+// the response is only sent when the query matches the local files of the modem, otherwise the command completes with an error
+modem_status_t modem_send_unsolicited_response_filtered(uint8_t file_id, uint32_t offset, uint32_t length, uint8_t* data,
+                                                        session_config_t* session_config, const alp_query_t* query);
+modem_status_t modem_send_unsolicited_response_filtered_async(uint8_t file_id, uint32_t offset, uint32_t length, uint8_t* data,
+                                                              session_config_t* session_config, const alp_query_t* query);
 modem_status_t modem_send_raw_unsolicited_response_async(uint8_t* alp_command, uint32_t length, alp_itf_id_t itf, void* interface_config);
 void modem_execute_raw_alp(uint8_t* alp, uint8_t len);
+void modem_send_ping(void);
+// aborts the active command (which completes with an error, or returns MODEM_STATUS_COMMAND_CANCELLED) and resets the
+// serial interface state
+void modem_reinit(void);
+
+// Builds one command containing multiple write and/or return file data actions (possibly for different files),
+// which are forwarded over the interface in session_config (or executed locally when session_config is NULL).
+// modem_batch_start() returns false when the modem is busy or the duty cycle limit of the interface is reached, the append
+// functions return false when the action does not fit in the command anymore. The batch is completed by calling one of
+// the send functions, or modem_batch_abort().
+bool modem_batch_start(session_config_t* session_config);
+bool modem_batch_start_prio(session_config_t* session_config, modem_priority_t priority);
+bool modem_batch_append_write(uint8_t file_id, uint32_t offset, uint32_t length, uint8_t* data);
+bool modem_batch_append_return(uint8_t file_id, uint32_t offset, uint32_t length, uint8_t* data);
+// the following actions are only executed when the query matches (on the remote nodes for a forwarded batch)
+bool modem_batch_append_query(const alp_query_t* query);
+modem_status_t modem_batch_send(void);
+modem_status_t modem_batch_send_async(void);
+void modem_batch_abort(void);
+
+// Writes the session config to an interface file on the modem (which should already exist with a big enough allocated length),
+// so it does not have to be transmitted over UART for every command anymore. On success handle is initialized
+// to refer to this file, and can be used as session config for subsequent commands.
+modem_status_t modem_register_session(uint8_t interface_file_id, session_config_t* session_config, session_config_t* handle);
+
+// Encodes an unsolicited response command once, which can then be sent repeatedly with new data.
+// Returns false when the command would not fit in one serial frame, sending it then returns MODEM_STATUS_COMMAND_TOO_LARGE.
+bool modem_prepare_unsolicited_response(modem_prepared_command_t* prepared, uint8_t file_id, uint32_t offset, uint32_t length,
+                                        session_config_t* session_config);
+modem_status_t modem_send_prepared_command(modem_prepared_command_t* prepared, uint8_t* data);
+modem_status_t modem_send_prepared_command_async(modem_prepared_command_t* prepared, uint8_t* data);
+
+// Reads a file on all nodes addressed by session_config (for example a NOID addressee with response mode ALL), and collects
+// all responses. modem_collect_file() blocks until the command is completed and stores the responses in the collector,
+// which should be initialized using modem_collector_init() first. modem_collect_file_async() passes every response to
+// the response_callback instead.
+void modem_collector_init(modem_response_collector_t* collector, modem_response_t* responses, uint8_t max_responses,
+                          uint8_t* data_pool, uint16_t data_pool_size);
+modem_response_t* modem_collector_find(modem_response_collector_t* collector, const d7ap_addressee_t* addressee);
+modem_status_t modem_collect_file(session_config_t* session_config, uint8_t file_id, uint32_t offset, uint32_t size,
+                                  modem_response_collector_t* collector);
+modem_status_t modem_collect_file_async(session_config_t* session_config, uint8_t file_id, uint32_t offset, uint32_t size);
+// only nodes for which the query matches (see alp_init_arithmetic_query() and alp_init_range_query()) respond
+modem_status_t modem_collect_file_filtered(session_config_t* session_config, const alp_query_t* query, uint8_t file_id,
+                                           uint32_t offset, uint32_t size, modem_response_collector_t* collector);
+modem_status_t modem_collect_file_filtered_async(session_config_t* session_config, const alp_query_t* query, uint8_t file_id,
+                                                 uint32_t offset, uint32_t size);
+
+// Reads or writes a (local) file which does not fit in one command, in chunks of MODEM_TRANSFER_CHUNK_SIZE bytes.
+// Multiple chunks are in flight at the same time, the file is never buffered completely on the host.
+// These functions block until the transfer is done, the sink and source are called from the calling thread.
+modem_status_t modem_read_file_stream(uint8_t file_id, uint32_t offset, uint32_t size, modem_transfer_sink_t sink, void* arg);
+modem_status_t modem_write_file_stream(uint8_t file_id, uint32_t offset, uint32_t size, modem_transfer_source_t source, void* arg);
+
+// Registers buffer as the mirror of the file. The buffer is assumed to be in sync with the file, if not call
+// modem_mirror_mark_all_dirty(). Modify the buffer using modem_mirror_write(), or modify it directly and call
+// modem_mirror_mark_dirty() afterwards. modem_mirror_sync() writes all dirty ranges in as few commands as possible.
+void modem_mirror_init(modem_mirror_t* mirror, uint8_t file_id, uint8_t* buffer, uint16_t size);
+void modem_mirror_write(modem_mirror_t* mirror, uint16_t offset, const uint8_t* data, uint16_t length);
+void modem_mirror_mark_dirty(modem_mirror_t* mirror, uint16_t offset, uint16_t length);
+void modem_mirror_mark_all_dirty(modem_mirror_t* mirror);
+bool modem_mirror_is_dirty(modem_mirror_t* mirror);
+modem_status_t modem_mirror_sync(modem_mirror_t* mirror);
+
+// Reads or writes the header of a file on the modem. Reading returns MODEM_STATUS_NOT_RETURNED (and leaves file_header
+// untouched) when the modem did not return the file properties.
+modem_status_t modem_read_file_header(uint8_t file_id, fs_file_header_t* file_header);
+modem_status_t modem_write_file_header(uint8_t file_id, fs_file_header_t* file_header);
+// Configures the D7 action protocol for a modem file: when the action condition is met (for example ALP_ACT_COND_WRITE)
+// the modem executes the ALP command stored in alp_cmd_file_id, and forwards the result over the interface stored in
+// interface_file_id (see modem_register_session()). When alp_cmd is NULL the command returns the complete file.
+// Both files should already exist on the modem, with a big enough allocated length.
+modem_status_t modem_enable_action_protocol(uint8_t file_id, alp_act_condition_t condition, uint8_t alp_cmd_file_id,
+                                            uint8_t* alp_cmd, uint8_t alp_cmd_length, uint8_t interface_file_id);
+modem_status_t modem_disable_action_protocol(uint8_t file_id);
+
+// Store-and-forward queue of unsolicited responses, which are sent over session_config in the background whenever the
+// modem is idle. Failed uplinks are retried after MODEM_UPLINK_RETRY_INTERVAL_MS. When storage is not NULL the queue is
+// restored from it on init, and every change is written to it. Should be called after modem_init().
+void modem_uplink_init(session_config_t* session_config, modem_uplink_drop_policy_t policy, const modem_uplink_storage_t* storage);
+// returns false when the uplink is dropped (for MODEM_UPLINK_DROP_NEWEST only)
+bool modem_uplink_push(uint8_t file_id, uint32_t offset, uint8_t length, uint8_t* data);
+// the uplink is sent in the given priority class, an urgent uplink cancels an active bulk command. The queue order is kept.
+bool modem_uplink_push_prio(uint8_t file_id, uint32_t offset, uint8_t length, uint8_t* data, modem_priority_t priority);
+void modem_uplink_get_stats(modem_uplink_stats_t* stats);
+
+// Batches sensor samples into compressed frames (see sample_codec.h), which are passed to flush, or pushed to the uplink
+// queue as the data of file_id when flush is NULL (in the class of batch->priority, which can be set after init). A frame
+// is flushed when it contains max_samples samples, when the next sample does not fit or max_age_ms after its first sample
+// was added, even when no samples follow. In the last case flush is called from the dispatch worker, so it should not wait
+// for a sync command. interval_s is passed to the backend to reconstruct the timestamps, 0 when the samples are irregular.
+// The file should be allocated for MODEM_SAMPLE_BATCH_MAX_SIZE bytes.
+void modem_sample_batch_init(modem_sample_batch_t* batch, uint8_t file_id, modem_sample_batch_flush_t flush,
+                             uint8_t max_samples, uint32_t max_age_ms, uint32_t interval_s);
+// returns false when a flushed frame was lost
+bool modem_sample_batch_add(modem_sample_batch_t* batch, int32_t sample);
+bool modem_sample_batch_flush(modem_sample_batch_t* batch);
+
+// Every command has a priority class. While a command is active, the other commands wait (up to MODEM_QUEUE_TIMEOUT_MS)
+// until it completes, and are served in priority order. The class is passed to the _prio functions, or set in the
+// prepared command, uplink or sample batch. Streaming transfers are always in the bulk class. Commands started with
+// MODEM_PRIORITY_DEFAULT (all other functions) use the class set for the calling thread by modem_set_thread_priority(),
+// this fails when MODEM_PRIORITY_THREADS threads have a class set already.
+// An urgent command cancels an active bulk command (a sync command or streaming transfer, which returns
+// MODEM_STATUS_COMMAND_CANCELLED), for the thread default only when preempt_bulk is set. Commands started from
+// callbacks never wait for the slot, but still cancel the bulk command so they can be retried (the uplink queue does so).
+// The preemption is host side only, there is no way to abort an ALP command on the modem: the modem finishes the cancelled
+// command first, the urgent command waits for it on the modem. This wait is included in the queueing delay of its class.
+bool modem_set_thread_priority(modem_priority_t priority, bool preempt_bulk);
+void modem_get_priority_stats(modem_priority_t priority, modem_priority_stats_t* stats);
+
+// Duty cycle limits known by the host scheduler. The sync send functions wait until the transmission is allowed, the async
+// ones return MODEM_STATUS_DUTY_CYCLE_LIMITED, and the uplink queue postpones the uplink. For D7 the strictest duty cycle of
+// the subbands of the access profile is used, with the bitrate of its channel class and coding. burst_ms is the airtime
+// which can be used at once after being idle, 0 only allows one transmission at a time. Every forwarded command is charged.
+// Returns ESIZE when all MODEM_SCHEDULER_BUCKETS are in use, or EINVAL when the LoRaWAN duty_permil is 0.
+error_t modem_scheduler_add_d7_access_profile(uint8_t access_class, const dae_access_profile_t* profile, uint32_t burst_ms);
+error_t modem_scheduler_add_lorawan(uint8_t spreading_factor, uint16_t duty_permil, uint32_t burst_ms);
+// returns how long to wait until a transmission using session_config is allowed
+uint32_t modem_scheduler_get_delay_ms(session_config_t* session_config);
+// Pings the modem every interval_ms, unless frames were received from it since the previous check. After max_misses
+// unanswered pings the modem is declared dead (see health_callback) and recovered using modem_reinit(). When reset_pin is
+// not GPIO_UNDEF the (active low) reset pin of the modem is pulsed as well.
+void modem_watchdog_start(uint32_t interval_ms, uint8_t max_misses, gpio_t reset_pin);
+void modem_watchdog_stop(void);
+void modem_get_health(modem_health_t* health);
+// Latency tracing of the commands, see modem_trace_timestamp_t. The records are returned oldest first.
+// Only recorded when MODEM_TRACE is defined (CFLAGS += -DMODEM_TRACE), otherwise no records are returned.
+uint8_t modem_get_trace(modem_trace_record_t* records, uint8_t max_records);
+// copies the MODEM_TRACE_HISTOGRAM_BUCKETS counters of the duration of phase, for the commands forwarded over itf
+void modem_get_trace_histogram(modem_trace_phase_t phase, modem_trace_itf_t itf, uint16_t* buckets);
+void modem_reset_trace(void);
+// shell command printing the trace ("modem_trace"), the histograms ("modem_trace hist") or resetting them ("modem_trace reset")
+int modem_trace_shell_cmd(int argc, char** argv);
+void modem_cache_set_policy(uint8_t file_id, modem_cache_policy_t policy);
+void modem_cache_invalidate(uint8_t file_id);
+bool modem_get_link_status(const uint8_t* uid, modem_link_status_t* status);
+uint8_t modem_get_link_table(modem_link_status_t* entries, uint8_t max_entries);
+void modem_get_dispatch_stats(modem_dispatch_stats_t* stats);
+void modem_reset_dispatch_stats(void);
 
 #endif
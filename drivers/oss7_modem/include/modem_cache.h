@@ -0,0 +1,58 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2018 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MODEM_CACHE_H
+#define MODEM_CACHE_H
+
+#include "types.h"
+
+/*
+ * Host side read-through cache of (local) modem files. Only files for which a caching policy is set
+ * (see modem_cache_set_policy()) are cached. Reads which are bigger than MODEM_CACHE_ENTRY_SIZE are never cached.
+ */
+
+#ifndef MODEM_CACHE_ENTRIES
+#define MODEM_CACHE_ENTRIES 4
+#endif
+
+#ifndef MODEM_CACHE_ENTRY_SIZE
+#define MODEM_CACHE_ENTRY_SIZE 32
+#endif
+
+/** @brief Looks up the requested file data in the cache
+ *  @return true on a cache hit, buffer is filled in this case
+ */
+bool modem_cache_lookup(uint8_t file_id, uint32_t offset, uint32_t length, uint8_t* buffer);
+
+/** @brief Stores file data read from the modem, if the policy of the file allows this
+ *  @return Void.
+ */
+void modem_cache_store(uint8_t file_id, uint32_t offset, uint32_t length, const uint8_t* data);
+
+/** @brief Called when we successfully wrote file data to the modem.
+ *  Overlapping entries are invalidated, for write-through files the written data is cached afterwards.
+ *  @return Void.
+ */
+void modem_cache_write(uint8_t file_id, uint32_t offset, uint32_t length, const uint8_t* data);
+
+/** @brief Invalidates all entries overlapping with the given range
+ *  @return Void.
+ */
+void modem_cache_invalidate_range(uint8_t file_id, uint32_t offset, uint32_t length);
+
+#endif //MODEM_CACHE_H
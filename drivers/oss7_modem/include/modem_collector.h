@@ -0,0 +1,40 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2018 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MODEM_COLLECTOR_H
+#define MODEM_COLLECTOR_H
+
+#include "modem.h"
+#include "alp.h"
+
+/*
+ * Pairs the interface status and file data of every responder to a (broadcast) command.
+ * The modem returns a RETURN_STATUS action followed by the RETURN_FILE_DATA action(s) for every responder.
+ */
+
+/** @brief Registers the interface status of a responder, the file data which follows will be added to this responder
+ *  @return Void.
+ */
+void modem_collector_add_status(modem_response_collector_t* collector, const d7ap_session_result_t* result);
+
+/** @brief Adds returned file data to the responder of the last status
+ *  @return The completed response, or NULL when the data could not be stored
+ */
+modem_response_t* modem_collector_add_file_data(modem_response_collector_t* collector, const alp_operand_file_data_t* operand);
+
+#endif //MODEM_COLLECTOR_H
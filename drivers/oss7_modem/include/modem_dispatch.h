@@ -0,0 +1,141 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2018 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MODEM_DISPATCH_H
+#define MODEM_DISPATCH_H
+
+#include "types.h"
+#include "fifo.h"
+#include "d7ap.h"
+
+#ifdef MODEM_USE_EVENT_QUEUE
+#include "event.h"
+#endif
+
+/*
+ * Events produced while parsing serial frames are not handled on the RX thread, but queued in a bounded queue
+ * and handled by a worker thread (or by a user supplied RIOT event queue when MODEM_USE_EVENT_QUEUE is defined).
+ * This way a slow handler (for example a user callback doing a printf or a flash write) does not stall UART parsing.
+ * Data events are dropped when the queue is full, command completions are queued separately in a slot reserved when the
+ * command starts, so they are always delivered.
+ * When MODEM_USE_EVENT_QUEUE is defined the received frames are parsed from that queue as well, so no threads are needed.
+ * Define it through CFLAGS (CFLAGS += -DMODEM_USE_EVENT_QUEUE), Makefile.dep then pulls in the event module.
+ */
+
+#ifndef MODEM_DISPATCH_QUEUE_SIZE
+#define MODEM_DISPATCH_QUEUE_SIZE 8 // max number of queued events
+#endif
+
+#ifndef MODEM_DISPATCH_COMPLETION_QUEUE_SIZE
+#define MODEM_DISPATCH_COMPLETION_QUEUE_SIZE 4 // max number of undelivered command completions, on top of the events
+#endif
+
+#ifndef MODEM_DISPATCH_DATA_BUFFER_SIZE
+#define MODEM_DISPATCH_DATA_BUFFER_SIZE 512 // shared buffer for the data of all queued events
+#endif
+
+#ifndef MODEM_DISPATCH_THREAD_PRIORITY
+#define MODEM_DISPATCH_THREAD_PRIORITY THREAD_PRIORITY_MAIN // should be lower than the RX thread
+#endif
+
+#ifndef MODEM_DISPATCH_THREAD_STACKSIZE
+#define MODEM_DISPATCH_THREAD_STACKSIZE THREAD_STACKSIZE_MAIN
+#endif
+
+typedef enum {
+    MODEM_EVENT_COMMAND_COMPLETED,
+    MODEM_EVENT_RETURN_FILE_DATA,
+    MODEM_EVENT_WRITE_FILE_DATA,
+    MODEM_EVENT_LINK_STATUS, // data contains a d7ap_session_result_t
+    MODEM_EVENT_RESPONSE, // data contains a d7ap_session_result_t followed by the returned file data
+    MODEM_EVENT_UPLINK_COMPLETED, // a command sent by the uplink queue completed
+} modem_event_type_t;
+
+#define MODEM_EVENT_MAX_DATA_SIZE (255 + sizeof(d7ap_session_result_t)) // file data is limited by the serial frame size
+
+typedef struct {
+    modem_event_type_t type;
+    bool with_error;
+    uint8_t tag_id; // of the completed command
+    uint8_t file_id;
+    uint32_t offset;
+    uint32_t size; // size of the data belonging to this event
+    uint32_t queued_timestamp;
+    uint32_t seq; // order in which the event was posted
+} modem_event_t;
+
+typedef void (*modem_dispatch_handler_t)(modem_event_t* event, uint8_t* data);
+typedef void (*modem_dispatch_idle_handler_t)(void);
+
+/** @brief Initializes the dispatch queue and starts the worker thread
+ *  @param handler Called from the worker for every queued event
+ *  @param idle_handler Called from the worker every time the queue is emptied, used for internal background work
+ *  @return Void.
+ */
+void modem_dispatch_init(modem_dispatch_handler_t handler, modem_dispatch_idle_handler_t idle_handler);
+
+/** @brief Wakes up the worker, so the idle handler is called. Can be called from interrupt context
+ *  @return Void.
+ */
+void modem_dispatch_wakeup(void);
+
+/** @brief Queues an event, to be handled by the worker
+ *  @param event The event, which is copied
+ *  @param data View on the data belonging to the event, which is copied as well. Can be NULL when event->size is 0
+ *  @return false when the queue is full, the event is dropped in this case
+ */
+bool modem_dispatch_post(modem_event_t* event, const fifo_view_t* data);
+
+/** @brief Reserves a slot in the completion queue, so the completion of a command can not be dropped. Should be called
+ *  before the command is started, the slot is used by modem_dispatch_post_completion() or freed by
+ *  modem_dispatch_cancel_completion()
+ *  @return false when all slots are reserved or used by undelivered completions
+ */
+bool modem_dispatch_reserve_completion(void);
+
+/** @brief Frees a slot reserved by modem_dispatch_reserve_completion(), for a command which did not post its completion
+ *  @return Void.
+ */
+void modem_dispatch_cancel_completion(void);
+
+/** @brief Queues a completion event (without data) in a slot reserved by modem_dispatch_reserve_completion(). The event
+ *  is dispatched after all events posted before it
+ *  @param event The event, which is copied
+ *  @return Void.
+ */
+void modem_dispatch_post_completion(modem_event_t* event);
+
+/** @brief Checks if the caller is executed by the worker (for example a user callback)
+ *  @return true when called from the worker
+ */
+bool modem_dispatch_in_worker(void);
+
+/** @brief Checks if the caller is executed by the thread processing the received frames, which should never wait for a
+ *  response. This is only possible when MODEM_USE_EVENT_QUEUE is defined, and called from the thread running the event loop
+ *  @return true when called from the thread processing the received frames
+ */
+bool modem_dispatch_in_event_thread(void);
+
+#ifdef MODEM_USE_EVENT_QUEUE
+/** @brief Returns the queue passed to modem_set_event_queue(), which handles the received frames as well
+ *  @return The event queue
+ */
+event_queue_t* modem_dispatch_get_event_queue(void);
+#endif
+
+#endif //MODEM_DISPATCH_H
@@ -36,6 +36,32 @@ void modem_interface_init(uint8_t idx, uint32_t baudrate, uint32_t mcu2modem, ui
  *  @return Void.
  */
 void modem_interface_transfer_bytes(uint8_t* bytes, uint8_t length, serial_message_type_t type);
+
+/** @brief Transmits a frame of which the payload consists of two parts (for example a pre-encoded header and user data),
+ *  without copying them in one buffer first
+ *  @param part1 First part of the payload
+ *  @param part1_length Length of the first part
+ *  @param part2 Second part of the payload, appended after part1. Can be NULL if part2_length is 0
+ *  @param part2_length Length of the second part
+ *  @param type type of message
+ *  @return Void.
+ */
+void modem_interface_transfer_parts(uint8_t* part1, uint8_t part1_length, uint8_t* part2, uint8_t part2_length, serial_message_type_t type);
+/** @brief Transmits a frame like modem_interface_transfer_parts(), and returns when the first and last byte were written
+ *  to the UART (in xtimer_now_usec() time). tx_start and tx_end can be NULL
+ *  @return Void.
+ */
+void modem_interface_transfer_parts_timed(uint8_t* part1, uint8_t part1_length, uint8_t* part2, uint8_t part2_length,
+                                          serial_message_type_t type, uint32_t* tx_start, uint32_t* tx_end);
+/** @brief Returns when the first byte of the frame being processed was received, should only be called from a handler
+ *  @return The timestamp in xtimer_now_usec() time
+ */
+uint32_t modem_interface_get_rx_frame_timestamp(void);
+/** @brief Drops all partially received data and resets the frame counters, used to recover from a modem reset.
+ *         The RX state is dropped asynchronously by the context parsing the received frames.
+ *  @return Void.
+ */
+void modem_interface_reset(void);
 /** @brief Transmits a string by adding a header and putting it in the UART fifo
  *  @param string Bytes that need to be transmitted
  *  @return Void.
@@ -0,0 +1,45 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2018 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MODEM_LINK_TABLE_H
+#define MODEM_LINK_TABLE_H
+
+#include "types.h"
+#include "d7ap.h"
+
+/*
+ * Keeps link quality statistics per D7 peer (keyed by UID), based on the interface status the modem returns
+ * for every response. Entries are only created by responses; when the table is full the least recently seen
+ * peer is replaced.
+ */
+
+#ifndef MODEM_LINK_TABLE_SIZE
+#define MODEM_LINK_TABLE_SIZE 8
+#endif
+
+/** @brief Updates the statistics of the responder, using the interface status of a received response
+ *  @return Void.
+ */
+void modem_link_table_update(const d7ap_session_result_t* result);
+
+/** @brief Registers a request unicasted to a peer, used to calculate the success rate. Ignored for peers not in the table.
+ *  @return Void.
+ */
+void modem_link_table_add_request(const uint8_t* uid);
+
+#endif //MODEM_LINK_TABLE_H
@@ -0,0 +1,32 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2018 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MODEM_SAMPLE_BATCH_H
+#define MODEM_SAMPLE_BATCH_H
+
+/*
+ * Internal interface of the sample batches (see modem_sample_batch_init()). A frame is flushed by the dispatch worker
+ * when the age timer of its first sample expires.
+ */
+
+/** @brief Flushes the frames of which the max age expired, called by the dispatch worker when idle
+ *  @return Void.
+ */
+void modem_sample_batch_run(void);
+
+#endif //MODEM_SAMPLE_BATCH_H
@@ -0,0 +1,59 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2018 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef MODEM_SCHEDULER_H
+#define MODEM_SCHEDULER_H
+
+#include "types.h"
+#include "alp.h"
+
+/*
+ * Host side duty cycle bookkeeping. Every configured interface (a D7 access class or LoRaWAN) has a token bucket of
+ * airtime, which is refilled at the duty cycle rate. A transmission is only allowed when the bucket is not in debt,
+ * the estimated airtime of the transmission is subtracted afterwards. This way we only send commands the modem will accept,
+ * instead of finding out through a rejected command or a timeout.
+ */
+
+#ifndef MODEM_SCHEDULER_BUCKETS
+#define MODEM_SCHEDULER_BUCKETS 4
+#endif
+
+#define MODEM_SCHEDULER_NO_BUCKET 0xFF
+
+/** @brief Looks up the bucket used for transmissions using this session config
+ *  @return The bucket, or MODEM_SCHEDULER_NO_BUCKET when the interface is not configured (not limited)
+ */
+uint8_t modem_scheduler_get_bucket(session_config_t* session_config);
+
+/** @brief Estimates the airtime of a transmission of payload_length bytes over the interface of the bucket
+ *  @return The airtime in us
+ */
+uint32_t modem_scheduler_estimate_airtime_us(uint8_t bucket, session_config_t* session_config, uint8_t payload_length);
+
+/** @brief Calculates how long we should wait before transmitting using the bucket
+ *  @return The delay in us, 0 when the transmission is allowed now
+ */
+uint32_t modem_scheduler_get_delay_us(uint8_t bucket);
+
+/** @brief Registers a transmission using the bucket
+ *  @return Void.
+ */
+void modem_scheduler_consume(uint8_t bucket, uint32_t airtime_us);
+
+#endif //MODEM_SCHEDULER_H
@@ -0,0 +1,48 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2018 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef MODEM_TRACE_H
+#define MODEM_TRACE_H
+
+#include "modem.h"
+
+/*
+ * Keeps the timestamps of the most recent commands in a ring, and a histogram of the duration of every phase per
+ * interface. A record is added when the command completes (or times out), the delivery is registered afterwards since
+ * it happens on another thread, possibly after the command slot is reused.
+ * Only enabled when MODEM_TRACE is defined.
+ */
+
+#ifdef MODEM_TRACE
+/** @brief Adds the record of a completed, timed out or cancelled command
+ *  @return Void.
+ */
+void modem_trace_complete(const modem_trace_record_t* record);
+
+/** @brief Registers the delivery of the result of the completed command with tag_id
+ *  @return Void.
+ */
+void modem_trace_delivered(uint8_t tag_id);
+#else
+// tracing is compiled out, so the ring and histograms do not cost any RAM
+static inline void modem_trace_complete(const modem_trace_record_t* record) { (void)record; }
+static inline void modem_trace_delivered(uint8_t tag_id) { (void)tag_id; }
+#endif
+
+#endif //MODEM_TRACE_H
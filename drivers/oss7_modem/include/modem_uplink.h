@@ -0,0 +1,53 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2018 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MODEM_UPLINK_H
+#define MODEM_UPLINK_H
+
+#include "modem.h"
+
+/*
+ * Internal interface of the uplink queue (see modem_uplink_init()), used by the modem driver to drain the queue
+ * from the dispatch worker whenever the modem is idle.
+ */
+
+#ifndef MODEM_UPLINK_RETRY_INTERVAL_MS
+#define MODEM_UPLINK_RETRY_INTERVAL_MS (10 * 1000) // back-off after a failed uplink
+#endif
+
+/** @brief Returns the session config used for all queued uplinks, or NULL when the queue is not initialized
+ *  @return The session config.
+ */
+session_config_t* modem_uplink_get_session_config(void);
+
+/** @brief Copies the oldest queued uplink, and marks it in flight. Should be followed by modem_uplink_done()
+ *  @return false when the queue is empty, an uplink is already in flight or we are backing off after a failure
+ */
+bool modem_uplink_take(modem_uplink_t* uplink);
+
+/** @brief Called when the uplink in flight completed. It is removed from the queue on success, or retried later otherwise
+ *  @return Void.
+ */
+void modem_uplink_done(bool success);
+
+/** @brief Called when the uplink taken could not be sent since the modem is busy, it is not counted as a failure
+ *  @return Void.
+ */
+void modem_uplink_release(void);
+
+#endif //MODEM_UPLINK_H
@@ -0,0 +1,58 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2018 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef MODEM_WATCHDOG_H
+#define MODEM_WATCHDOG_H
+
+#include "types.h"
+#include "fifo.h"
+
+/*
+ * Monitors whether the modem is still responsive. Every interval the modem is pinged, unless a frame was received from it
+ * since the previous check. After max_misses unanswered pings the modem is declared dead and recovered using modem_reinit()
+ * and, when configured, by pulsing its reset pin. The checks are executed by the dispatch worker.
+ */
+
+#ifndef MODEM_WATCHDOG_RESET_PULSE_MS
+#define MODEM_WATCHDOG_RESET_PULSE_MS 10 // duration the (active low) reset pin is asserted
+#endif
+
+typedef void (*modem_watchdog_health_handler_t)(bool alive);
+
+/** @brief Initializes the watchdog, handler is called from the dispatch worker when the modem is declared dead or alive
+ *  @return Void.
+ */
+void modem_watchdog_init(modem_watchdog_health_handler_t handler);
+
+/** @brief Registers activity of the modem, called for every received frame
+ *  @return Void.
+ */
+void modem_watchdog_feed(void);
+
+/** @brief Handles a ping response frame, called from the RX thread
+ *  @return Void.
+ */
+void modem_watchdog_process_ping_response(fifo_t* fifo);
+
+/** @brief Executes the pending checks, called by the dispatch worker when idle
+ *  @return Void.
+ */
+void modem_watchdog_run(void);
+
+#endif //MODEM_WATCHDOG_H
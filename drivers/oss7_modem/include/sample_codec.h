@@ -0,0 +1,66 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2018 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef SAMPLE_CODEC_H
+#define SAMPLE_CODEC_H
+
+#include "types.h"
+
+/*
+ * Compact encoding of a batch of sensor samples, sent as the data of one unsolicited response.
+ * A frame consists of a header followed by the samples:
+ *   version (1 byte), seqnr (1 byte), sample count (1 byte), sample interval in s (varint)
+ *   first sample (zig-zag varint), difference with the previous sample (zig-zag varint) for every next sample
+ * Varints use 7 bits per byte, least significant group first, with the MSB set when more bytes follow.
+ * This module has no dependencies on the modem or the OS, so the decoder can be used by the backend as well.
+ */
+
+#define SAMPLE_CODEC_VERSION 1
+#define SAMPLE_CODEC_VARINT_MAX_SIZE 5
+#define SAMPLE_CODEC_HEADER_MAX_SIZE (3 + SAMPLE_CODEC_VARINT_MAX_SIZE)
+
+typedef struct {
+    uint8_t version;
+    uint8_t seqnr;      // incremented for every frame, allows the backend to detect missing frames
+    uint8_t count;
+    uint32_t interval_s; // time between the samples, 0 when unknown or irregular
+} sample_codec_header_t;
+
+/** @brief Encodes value as a varint, when buffer is NULL only the length is returned
+ *  @return The number of bytes
+ */
+uint8_t sample_codec_encode_varint(uint8_t* buffer, uint32_t value);
+
+/** @brief Encodes the frame header
+ *  @return The number of bytes, at most SAMPLE_CODEC_HEADER_MAX_SIZE
+ */
+uint8_t sample_codec_encode_header(uint8_t* buffer, const sample_codec_header_t* header);
+
+/** @brief Encodes a sample as the difference with the previous sample (which is 0 for the first sample of a frame),
+ *  when buffer is NULL only the length is returned
+ *  @return The number of bytes
+ */
+uint8_t sample_codec_encode_sample(uint8_t* buffer, int32_t previous, int32_t sample);
+
+/** @brief Decodes a frame, at most max_samples samples are stored
+ *  @return The number of samples in the frame, or -1 when the frame is invalid or has an unsupported version
+ */
+int sample_codec_decode(const uint8_t* frame, uint8_t length, sample_codec_header_t* header, int32_t* samples, uint8_t max_samples);
+
+#endif //SAMPLE_CODEC_H
@@ -23,10 +23,21 @@
 #include "fifo.h"
 #include "alp.h"
 #include "d7ap.h"
+#include "fs.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include "modem_interface.h"
+#include "modem_dispatch.h"
+#include "modem_cache.h"
+#include "modem_link_table.h"
+#include "modem_collector.h"
+#include "modem_uplink.h"
+#include "modem_scheduler.h"
+#include "modem_watchdog.h"
+#include "modem_sample_batch.h"
+#include "modem_trace.h"
 #include "mutex.h"
+#include "thread.h"
 #include "xtimer.h"
 #include "string.h"
 
@@ -35,6 +46,25 @@
 
 #define CMD_TIMEOUT_MS 1000 * 30
 
+#define MODEM_RESPONSE_MAX_SIZE 255 // a response should fit in one serial frame
+#define MODEM_INTERFACE_CONFIG_MAX_SIZE (1 + 1 + 1 + 16 + 16 + 4 + 4 + 1) // LoRaWAN ABP config is the largest, +1 since the fifo can't be filled completely
+
+#ifndef MODEM_TRANSFER_CHUNK_SIZE
+#define MODEM_TRANSFER_CHUNK_SIZE 128 // a chunk and its response should fit in one serial frame
+#endif
+
+#if MODEM_TRANSFER_CHUNK_SIZE + ALP_OP_SIZE_CHUNK + ALP_OP_SIZE_REQUEST_TAG + ALP_OP_SIZE_READ_FILE_DATA > MODEM_RESPONSE_MAX_SIZE
+#error "MODEM_TRANSFER_CHUNK_SIZE does not fit in one serial frame"
+#endif
+
+#ifndef MODEM_TRANSFER_WINDOW
+#define MODEM_TRANSFER_WINDOW 4 // max number of chunks in flight
+#endif
+
+#ifndef MODEM_QUEUE_TIMEOUT_MS
+#define MODEM_QUEUE_TIMEOUT_MS CMD_TIMEOUT_MS // max time to wait for the command slot, 0 to return MODEM_STATUS_BUSY immediately
+#endif
+
 #define DPRINT(...) printf(__VA_ARGS__)
 #define DPRINT_DATA(...)
 
@@ -42,10 +72,32 @@
 typedef struct {
   uint8_t tag_id;
   bool is_active;
+  volatile bool is_completed; // completed by the modem, set from the RX thread
+  volatile bool cancel_requested; // the command is cancelled in favour of an urgent command
+  modem_priority_t priority;
+  uint32_t queue_wait_us; // time waited for the command slot
   bool completed_with_error;
   fifo_t fifo;
   bool execute_synchronuous;
-  uint8_t* response_buffer; // used for sync responses
+  bool is_forwarded; // command is executed on a remote node (and does not affect the local files)
+  bool is_uplink; // command is sent by the uplink queue, its completion is not reported to the user
+  bool completion_reserved; // a dispatch slot is reserved for the completion event, so it can not be dropped
+  uint8_t airtime_bucket; // duty cycle bucket charged when the command is transferred
+  uint8_t forwarded_offset; // offset in fifo of the actions which are forwarded (and transmitted by the modem)
+  session_config_t* session_config; // session of a forwarded command, should stay valid until the command is transferred
+  bool has_target_uid; // command is unicasted to a D7 node
+  uint8_t target_uid[D7A_FILE_UID_SIZE];
+  const modem_read_req_t* read_reqs; // used for sync responses, the returned file data is scattered over these
+  uint8_t read_req_count;
+  uint8_t* read_filled; // bitmap of the read requests which were returned completely, owned by the caller
+  uint8_t file_header_file_id; // file of which the properties are read synchronously
+  fs_file_header_t* file_header; // filled with the returned file properties, for sync commands
+  bool file_header_received;
+  modem_response_collector_t* collector; // used for sync collect commands, the responses of all responders are stored here
+  bool stream_responses; // async collect command, every response is passed to the response callback
+  bool has_last_status; // a status was received for which the file data is not received yet (in the current frame)
+  d7ap_session_result_t last_status;
+  modem_trace_record_t trace;
   uint8_t buffer[256];
 } command_t;
 
@@ -54,65 +106,602 @@ static mutex_t cmd_mutex = MUTEX_INIT;
 static command_t command; // TODO only one active command supported for now
 static uint8_t next_tag_id = 0;
 
-static void process_serial_frame(fifo_t* fifo) {
-  bool command_completed = false;
-  while(fifo_get_size(fifo)) {
-    alp_action_t action;
-    alp_parse_action(fifo, &action);
-
-    switch(action.operation) {
-      case ALP_OP_RETURN_TAG:
-        if(action.tag_response.tag_id == command.tag_id) {
-          command_completed = action.tag_response.completed;
-          command.completed_with_error = action.tag_response.error;
-        } else {
-          DPRINT("received resp with unexpected tag_id (%i vs %i)\n", action.tag_response.tag_id, command.tag_id);
-          // TODO unsolicited responses
-        }
-        break;
-      case ALP_OP_WRITE_FILE_DATA:
-        if(callbacks->write_file_data_callback)
-          callbacks->write_file_data_callback(action.file_data_operand.file_offset.file_id,
-                                               action.file_data_operand.file_offset.offset,
-                                               action.file_data_operand.provided_data_length,
-                                               action.file_data_operand.data);
-        break;
-      case ALP_OP_RETURN_FILE_DATA:
-        if(command.execute_synchronuous) {
-          memcpy(command.response_buffer, action.file_data_operand.data, action.file_data_operand.provided_data_length);
-        } else if(callbacks->return_file_data_callback) {
-          callbacks->return_file_data_callback(action.file_data_operand.file_offset.file_id,
-                                               action.file_data_operand.file_offset.offset,
-                                               action.file_data_operand.provided_data_length,
-                                               action.file_data_operand.data);
-        }
-        break;
-      case ALP_OP_RETURN_STATUS: ;
-        d7ap_session_result_t interface_status = *((d7ap_session_result_t*)action.status.data);
-        //uint8_t addressee_len =
-        d7ap_addressee_id_length(interface_status.addressee.ctrl.id_type);
-        DPRINT("received resp\n");
-        // TODO DPRINT_DATA(interface_status.addressee.id, addressee_len);
-        // TODO callback?
-        break;
-      default:
-        assert(false);
+// threads waiting for the command slot, sorted on priority and FIFO within a priority class
+typedef struct waiter {
+  struct waiter* next;
+  modem_priority_t priority;
+  bool granted;
+  mutex_t signal; // unlocked when the slot is handed over to this waiter
+} waiter_t;
+
+// default priority class of the commands started by a thread, see modem_set_thread_priority()
+typedef struct {
+  kernel_pid_t pid; // KERNEL_PID_UNDEF when unused
+  uint8_t priority : 2;
+  bool preempt_bulk : 1;
+} thread_settings_t;
+
+static waiter_t* waiters = NULL;
+static mutex_t slot_mutex = MUTEX_INIT; // protects command.is_active and the waiters
+static thread_settings_t thread_settings[MODEM_PRIORITY_THREADS];
+static modem_priority_stats_t priority_stats[MODEM_PRIORITY_COUNT];
+
+// Cancelling a bulk command only frees the command slot on the host, the modem still executes it. The next command waits
+// on the modem until the tag of the cancelled command is returned, this wait is added to its queueing delay.
+static volatile bool preempted_pending = false;
+static volatile uint8_t preempted_tag_id; // last tag transmitted by the cancelled command
+
+// a streaming file transfer, sent as one ALP command which is split over multiple frames using chunk actions. Every
+// frame requests its own tag, so the chunks are acknowledged separately. The transfer holds the command slot for its
+// whole duration and tracks the tags of the chunks in flight itself.
+typedef struct {
+  volatile bool active;
+  bool is_read;
+  volatile bool failed;
+  uint8_t file_id;
+  uint32_t offset;
+  uint32_t size;
+  uint8_t first_tag_id; // tag ID of the first chunk, the following chunks use consecutive tag IDs
+  uint16_t chunk_count;
+  volatile uint16_t acked; // number of chunks completed by the modem, the modem handles the chunks in order
+  uint8_t last_sent_tag_id;
+  uint16_t chunk_length[MODEM_TRANSFER_WINDOW]; // 0 until the file data of the read chunk is returned
+  uint8_t chunk_data[MODEM_TRANSFER_WINDOW][MODEM_TRANSFER_CHUNK_SIZE]; // returned data of the read chunks in flight
+} transfer_t;
+
+static transfer_t transfer;
+static mutex_t transfer_mutex = MUTEX_INIT_LOCKED; // unlocked by the RX thread when a chunk is completed
+
+// async commands have nobody waiting for them, so they are expired by the worker when the modem does not respond in time
+static void command_timeout(void* arg);
+static xtimer_t command_timer = { .callback = &command_timeout };
+static volatile bool command_expired = false;
+static volatile uint8_t expired_tag_id;
+
+// executed by the dispatch worker, so user callbacks never run on the RX thread
+static void dispatch_event(modem_event_t* event, uint8_t* data) {
+  switch(event->type) {
+    case MODEM_EVENT_COMMAND_COMPLETED:
+      if(callbacks->command_completed_callback)
+        callbacks->command_completed_callback(event->with_error);
+
+      modem_trace_delivered(event->tag_id);
+      break;
+    case MODEM_EVENT_RETURN_FILE_DATA:
+      if(callbacks->return_file_data_callback)
+        callbacks->return_file_data_callback(event->file_id, event->offset, event->size, data);
+      break;
+    case MODEM_EVENT_WRITE_FILE_DATA:
+      if(callbacks->write_file_data_callback)
+        callbacks->write_file_data_callback(event->file_id, event->offset, event->size, data);
+      break;
+    case MODEM_EVENT_LINK_STATUS:
+      if(callbacks->link_status_callback)
+        callbacks->link_status_callback((d7ap_session_result_t*)data);
+      break;
+    case MODEM_EVENT_UPLINK_COMPLETED:
+      modem_uplink_done(!event->with_error);
+      modem_trace_delivered(event->tag_id);
+      break;
+    case MODEM_EVENT_RESPONSE:
+      if(callbacks->response_callback) {
+        modem_response_t response = {
+          .file_id = event->file_id,
+          .offset = event->offset,
+          .length = event->size - sizeof(d7ap_session_result_t),
+          .data = data + sizeof(d7ap_session_result_t)
+        };
+
+        memcpy(&response.status, data, sizeof(d7ap_session_result_t));
+        callbacks->response_callback(&response);
+      }
+
+      // the link status of a streamed response is not posted separately, to post only one event per responder
+      if(callbacks->link_status_callback)
+        callbacks->link_status_callback((d7ap_session_result_t*)data);
+      break;
+  }
+}
+
+static void post_link_status_event(d7ap_session_result_t* result) {
+  modem_event_t event = { .type = MODEM_EVENT_LINK_STATUS, .size = sizeof(d7ap_session_result_t) };
+  fifo_view_t data = { .part1 = (uint8_t*)result, .part1_len = sizeof(d7ap_session_result_t) };
+  modem_dispatch_post(&event, &data);
+}
+
+static void post_file_data_event(modem_event_type_t type, alp_operand_file_data_t* operand) {
+  modem_event_t event = {
+    .type = type,
+    .file_id = operand->file_offset.file_id,
+    .offset = operand->file_offset.offset,
+    .size = operand->provided_data_length
+  };
+
+  modem_dispatch_post(&event, &operand->data);
+}
+
+static void post_response_event(d7ap_session_result_t* status, alp_operand_file_data_t* operand) {
+  modem_event_t event = {
+    .type = MODEM_EVENT_RESPONSE,
+    .file_id = operand->file_offset.file_id,
+    .offset = operand->file_offset.offset,
+    .size = sizeof(d7ap_session_result_t) + operand->provided_data_length
+  };
+
+  // the data fifo of the dispatcher takes 2 parts, so the status is put in front of the (possibly wrapped) file data
+  static uint8_t data[MODEM_EVENT_MAX_DATA_SIZE]; // static to spare the RX thread stack
+  memcpy(data, status, sizeof(d7ap_session_result_t));
+  fifo_view_copy(&operand->data, data + sizeof(d7ap_session_result_t));
+  fifo_view_t view = { .part1 = data, .part1_len = event.size };
+  modem_dispatch_post(&event, &view);
+}
+
+// copies returned file data in to the buffer(s) of the matching read request(s)
+static void scatter_file_data(alp_operand_file_data_t* operand) {
+  for(uint8_t i = 0; i < command.read_req_count; i++) {
+    const modem_read_req_t* req = &command.read_reqs[i];
+    if(req->file_id != operand->file_offset.file_id || req->offset != operand->file_offset.offset)
+      continue;
+
+    if(operand->provided_data_length < req->size) {
+      DPRINT("returned file data shorter than requested\n");
+      fifo_view_copy(&operand->data, req->buffer); // the request is not marked filled, the rest is not initialized
+      continue;
     }
+
+    fifo_view_t data = operand->data;
+    if(operand->provided_data_length > req->size) {
+      DPRINT("returned file data larger than requested, truncating\n");
+      if(data.part1_len >= req->size) {
+        data.part1_len = req->size;
+        data.part2_len = 0;
+      } else {
+        data.part2_len = req->size - data.part1_len;
+      }
+    }
+
+    fifo_view_copy(&data, req->buffer);
+    command.read_filled[i / 8] |= 1 << (i % 8);
+  }
+}
+
+static uint8_t get_rank(modem_priority_t priority) {
+  switch(priority) {
+    case MODEM_PRIORITY_URGENT:
+      return 0;
+    case MODEM_PRIORITY_NORMAL:
+      return 1;
+    default:
+      return 2;
+  }
+}
+
+// wakes up the thread waiting for the active command, which returns MODEM_STATUS_COMMAND_CANCELLED and releases the
+// command slot. Should be called with slot_mutex locked. Returns false for async commands, nobody is waiting for their result
+static bool cancel_command(void) {
+  if(command.cancel_requested)
+    return true;
+
+  if(transfer.active) {
+    command.cancel_requested = true;
+    mutex_unlock(&transfer_mutex);
+  } else if(command.execute_synchronuous) {
+    command.cancel_requested = true;
+    mutex_unlock(&cmd_mutex);
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+// cancels the active command when it is a bulk command a thread is waiting for, should be called with slot_mutex locked
+static void cancel_bulk_command(void) {
+  if(command.priority != MODEM_PRIORITY_BULK || command.cancel_requested)
+    return;
+
+  if(!cancel_command())
+    return; // async commands are not cancelled
+
+  priority_stats[MODEM_PRIORITY_BULK].cancelled++;
+  preempted_tag_id = transfer.active ? transfer.last_sent_tag_id : command.tag_id;
+  preempted_pending = true;
+  DPRINT("cancelling bulk command for urgent command\n");
+}
+
+// should be called with slot_mutex locked
+static thread_settings_t* find_thread_settings(kernel_pid_t pid) {
+  for(uint8_t i = 0; i < MODEM_PRIORITY_THREADS; i++) {
+    if(thread_settings[i].pid == pid)
+      return &thread_settings[i];
+  }
+
+  return NULL;
+}
+
+// waits until the command slot is free, or handed over to us
+static bool acquire_command_slot(modem_priority_t priority) {
+  mutex_lock(&slot_mutex);
+  bool preempt_bulk = priority == MODEM_PRIORITY_URGENT;
+  if(priority == MODEM_PRIORITY_DEFAULT) {
+    thread_settings_t* settings = find_thread_settings(thread_getpid());
+    priority = settings ? settings->priority : MODEM_PRIORITY_NORMAL;
+    preempt_bulk = settings && settings->preempt_bulk;
+  }
+
+  assert(priority < MODEM_PRIORITY_COUNT);
+  modem_priority_stats_t* stats = &priority_stats[priority];
+  if(!command.is_active) {
+    command.is_active = true;
+    command.priority = priority;
+    command.queue_wait_us = 0;
+    stats->commands++;
+    mutex_unlock(&slot_mutex);
+    return true;
+  }
+
+  if(priority == MODEM_PRIORITY_URGENT && preempt_bulk)
+    cancel_bulk_command();
+
+  // commands started from callbacks do not wait, since this would stall the dispatching of events
+  if(MODEM_QUEUE_TIMEOUT_MS == 0 || modem_dispatch_in_worker() || modem_dispatch_in_event_thread()) {
+    stats->timeouts++;
+    mutex_unlock(&slot_mutex);
+    return false;
+  }
+
+  waiter_t waiter = { .priority = priority, .granted = false, .signal = MUTEX_INIT_LOCKED };
+  // insert after all waiters with the same or a higher priority
+  waiter_t** pos = &waiters;
+  while(*pos && get_rank((*pos)->priority) <= get_rank(priority))
+    pos = &(*pos)->next;
+
+  waiter.next = *pos;
+  *pos = &waiter;
+  mutex_unlock(&slot_mutex);
+
+  uint32_t start = xtimer_now_usec();
+  xtimer_mutex_lock_timeout(&waiter.signal, MODEM_QUEUE_TIMEOUT_MS * 1000);
+  uint32_t wait = xtimer_now_usec() - start;
+
+  mutex_lock(&slot_mutex);
+  if(waiter.granted) {
+    command.queue_wait_us = wait;
+    stats->commands++;
+    stats->waited++;
+    stats->total_wait_us += wait;
+    if(wait > stats->max_wait_us)
+      stats->max_wait_us = wait;
+  } else {
+    // timeout, we are still in the list
+    for(pos = &waiters; *pos != &waiter; pos = &(*pos)->next);
+    *pos = waiter.next;
+    stats->timeouts++;
+  }
+
+  mutex_unlock(&slot_mutex);
+  return waiter.granted;
+}
+
+// hands the command slot over to the first waiter, or frees it
+static void release_command(void) {
+  if(command.completion_reserved) {
+    command.completion_reserved = false;
+    modem_dispatch_cancel_completion();
+  }
+
+  mutex_lock(&slot_mutex);
+  // late responses of this command should not be copied to the caller's buffers anymore
+  command.read_req_count = 0;
+  command.collector = NULL;
+  command.file_header = NULL;
+
+  waiter_t* waiter = waiters;
+  if(waiter) {
+    waiters = waiter->next;
+    waiter->granted = true;
+    command.priority = waiter->priority;
+    mutex_unlock(&waiter->signal);
+  } else {
+    command.is_active = false;
+  }
+
+  mutex_unlock(&slot_mutex);
+  modem_dispatch_wakeup(); // the modem might be idle now, so queued uplinks can be sent
+}
+
+bool modem_set_thread_priority(modem_priority_t priority, bool preempt_bulk) {
+  assert(priority < MODEM_PRIORITY_COUNT);
+  kernel_pid_t pid = thread_getpid();
+  mutex_lock(&slot_mutex);
+  thread_settings_t* settings = find_thread_settings(pid);
+  if(settings == NULL)
+    settings = find_thread_settings(KERNEL_PID_UNDEF);
+
+  bool is_default = priority == MODEM_PRIORITY_NORMAL && !preempt_bulk;
+  if(settings) {
+    settings->pid = is_default ? KERNEL_PID_UNDEF : pid; // the default needs no entry
+    settings->priority = priority;
+    settings->preempt_bulk = preempt_bulk;
+  }
+
+  mutex_unlock(&slot_mutex);
+  if(settings == NULL && !is_default) {
+    DPRINT("!!! no room to set the priority of thread %i\n", pid);
+    return false;
+  }
+
+  return true;
+}
+
+void modem_get_priority_stats(modem_priority_t priority, modem_priority_stats_t* stats) {
+  assert(priority < MODEM_PRIORITY_COUNT);
+  mutex_lock(&slot_mutex);
+  *stats = priority_stats[priority];
+  mutex_unlock(&slot_mutex);
+}
+
+static void process_transfer_tag(uint8_t tag_id, bool error) {
+  if(tag_id != (uint8_t)(transfer.first_tag_id + transfer.acked)) {
+    DPRINT("received transfer resp with unexpected tag_id %i\n", tag_id);
+    transfer.failed = true;
+  } else if(error) {
+    transfer.failed = true;
+  } else if(transfer.is_read && transfer.chunk_length[transfer.acked % MODEM_TRANSFER_WINDOW] == 0) {
+    DPRINT("transfer chunk completed without file data\n");
+    transfer.failed = true;
+  } else {
+    transfer.acked++;
   }
 
+  mutex_unlock(&transfer_mutex);
+}
+
+static void store_transfer_chunk(alp_operand_file_data_t* operand) {
+  uint32_t chunk_offset = operand->file_offset.offset - transfer.offset;
+  if(operand->file_offset.file_id != transfer.file_id || chunk_offset % MODEM_TRANSFER_CHUNK_SIZE != 0
+     || operand->provided_data_length > MODEM_TRANSFER_CHUNK_SIZE) {
+    DPRINT("received unexpected file data during transfer, dropping\n");
+    return;
+  }
+
+  uint8_t slot = (chunk_offset / MODEM_TRANSFER_CHUNK_SIZE) % MODEM_TRANSFER_WINDOW;
+  transfer.chunk_length[slot] = operand->provided_data_length;
+  fifo_view_copy(&operand->data, transfer.chunk_data[slot]);
+}
+
+// the results of the tag responses in a frame, processed after the complete frame is parsed
+typedef struct {
+  bool command_completed;
+  bool chunk_completed; // only valid for a transfer
+  bool chunk_error;
+  uint8_t chunk_tag_id;
+} frame_result_t;
 
-  if(command_completed) {
+// the modem completed the cancelled bulk command, the active command waited on the modem since it was transmitted
+static void add_modem_wait(void) {
+  preempted_pending = false;
+  mutex_lock(&slot_mutex);
+  uint32_t tx_end = command.trace.timestamps[MODEM_TRACE_TX_END];
+  if(command.is_active && !command.is_completed && tx_end != 0) {
+    uint32_t wait = xtimer_now_usec() - tx_end;
+    modem_priority_stats_t* stats = &priority_stats[command.priority];
+    stats->total_wait_us += wait;
+    if(command.queue_wait_us + wait > stats->max_wait_us)
+      stats->max_wait_us = command.queue_wait_us + wait;
+  }
+
+  mutex_unlock(&slot_mutex);
+}
+
+static void on_return_tag(uint8_t tag_id, bool completed, bool error, void* arg) {
+  frame_result_t* result = arg;
+  if(transfer.active) {
+    // the returned file data of the chunk might follow the tag response, so the chunk is processed after the frame
+    if(completed) {
+      result->chunk_completed = true;
+      result->chunk_error = error;
+      result->chunk_tag_id = tag_id;
+    }
+  } else if(tag_id == command.tag_id) {
+    result->command_completed = completed;
+    command.completed_with_error = error;
+  } else if(preempted_pending && completed && tag_id == preempted_tag_id) {
+    add_modem_wait();
+  } else {
+    DPRINT("received resp with unexpected tag_id (%i vs %i)\n", tag_id, command.tag_id);
+    // TODO unsolicited responses
+  }
+}
+
+static void on_write_file_data(alp_operand_file_data_t* operand, void* arg) {
+  (void)arg;
+  modem_cache_invalidate_range(operand->file_offset.file_id, operand->file_offset.offset, operand->provided_data_length);
+  post_file_data_event(MODEM_EVENT_WRITE_FILE_DATA, operand);
+}
+
+static void on_return_file_data(alp_operand_file_data_t* operand, void* arg) {
+  (void)arg;
+  if(transfer.active && transfer.is_read) {
+    store_transfer_chunk(operand);
+  } else if(command.collector) {
+    modem_collector_add_file_data(command.collector, operand);
+  } else if(command.stream_responses) {
+    if(command.has_last_status)
+      post_response_event(&command.last_status, operand);
+    else
+      DPRINT("received file data without status, dropping\n");
+
+    command.has_last_status = false;
+  } else if(command.execute_synchronuous) {
+    scatter_file_data(operand);
+  } else {
+    post_file_data_event(MODEM_EVENT_RETURN_FILE_DATA, operand);
+  }
+}
+
+static void on_return_file_properties(alp_operand_file_header_t* operand, void* arg) {
+  (void)arg;
+  if(command.file_header && operand->file_id == command.file_header_file_id) {
+    alp_decode_file_header(operand->file_header, command.file_header);
+    command.file_header_received = true;
+  }
+}
+
+static void on_return_status(alp_interface_status_t* status, void* arg) {
+  (void)arg;
+  if(status->itf_id == ALP_ITF_ID_LORAWAN_ABP || status->itf_id == ALP_ITF_ID_LORAWAN_OTAA) {
+    DPRINT("received LoRaWAN status, error %i, duty cycle wait %i\n", status->lorawan_session_result.error_state,
+           status->lorawan_session_result.duty_cycle_wait_time);
+    return;
+  }
+
+  if(status->itf_id != ALP_ITF_ID_D7ASP)
+    return;
+
+  DPRINT("received resp, link budget %i\n", status->d7ap_session_result.link_budget);
+  modem_link_table_update(&status->d7ap_session_result);
+  if(command.stream_responses) {
+    // posted together with the returned file data, see flush_last_status()
+    command.last_status = status->d7ap_session_result;
+    command.has_last_status = true;
+    return;
+  }
+
+  post_link_status_event(&status->d7ap_session_result);
+  if(command.collector)
+    modem_collector_add_status(command.collector, &status->d7ap_session_result);
+}
+
+static void on_action_status(uint8_t action_index, alp_status_codes_t status, void* arg) {
+  (void)arg;
+  if(status != ALP_STATUS_OK)
+    DPRINT("action %i failed with status %x\n", action_index, status);
+}
+
+static const alp_visitor_t alp_visitor = {
+  .return_tag = on_return_tag,
+  .write_file_data = on_write_file_data,
+  .return_file_data = on_return_file_data,
+  .return_file_properties = on_return_file_properties,
+  .return_status = on_return_status,
+  .action_status = on_action_status,
+};
+
+static void command_timeout(void* arg) {
+  expired_tag_id = (uint8_t)(uintptr_t)arg;
+  command_expired = true;
+  modem_dispatch_wakeup(); // interrupt safe, the command is expired by the worker
+}
+
+// completes the active async command, unless it is completed already (by the modem, by a timeout or when aborted)
+static void complete_async_command(bool with_error) {
+  mutex_lock(&slot_mutex);
+  bool already_completed = command.is_completed;
+  command.is_completed = true;
+  mutex_unlock(&slot_mutex);
+  if(already_completed)
+    return;
+
+  xtimer_remove(&command_timer);
+  command.completed_with_error = with_error;
+  // copied first, a waiter which gets the command slot reinitializes the command
+  modem_event_t event = {
+    .type = command.is_uplink ? MODEM_EVENT_UPLINK_COMPLETED : MODEM_EVENT_COMMAND_COMPLETED,
+    .with_error = with_error,
+    .tag_id = command.tag_id
+  };
+
+  // the reservation is kept for the event, a dropped completion would stall the uplink queue or the caller
+  assert(command.completion_reserved);
+  command.completion_reserved = false;
+  release_command(); // before notifying, so a new command can be started from the callback
+  modem_dispatch_post_completion(&event);
+}
+
+// posts the link status of a streamed response for which no file data was returned in the frame
+static void flush_last_status(void) {
+  if(command.has_last_status)
+    post_link_status_event(&command.last_status);
+
+  command.has_last_status = false;
+}
+
+static void process_serial_frame(fifo_t* fifo) {
+  frame_result_t result = { .command_completed = false, .chunk_completed = false };
+  modem_watchdog_feed();
+  alp_parser_t parser;
+  alp_parser_init(&parser, fifo, &alp_visitor, &result);
+  while(!alp_parser_done(&parser)) {
+    if(alp_parser_next(&parser) != SUCCESS)
+      DPRINT("!!! failed to parse action, dropping the rest of the frame\n");
+  }
+
+  flush_last_status(); // the status and file data of a response are in the same frame
+
+  if(result.chunk_completed && transfer.active)
+    process_transfer_tag(result.chunk_tag_id, result.chunk_error);
+
+  if(result.command_completed) {
+    preempted_pending = false; // the modem executes the commands in order, the cancelled one might not be answered
     //DPRINT("command with tag %i completed @ %i", command.tag_id, timer_get_counter_value());
     DPRINT("command with tag %i completed\n", command.tag_id);
+    command.trace.timestamps[MODEM_TRACE_RX_START] = modem_interface_get_rx_frame_timestamp();
+    command.trace.timestamps[MODEM_TRACE_TAG_PARSED] = xtimer_now_usec();
+    command.trace.completed = true;
+    command.trace.with_error = command.completed_with_error;
+    modem_trace_complete(&command.trace);
     if(command.execute_synchronuous) {
-      mutex_unlock(&cmd_mutex);
+      command.is_completed = true;
+      mutex_unlock(&cmd_mutex); // the waiting thread releases the command slot, after reading the result
     } else {
-      if(callbacks->command_completed_callback)
-        callbacks->command_completed_callback(command.completed_with_error);
+      complete_async_command(command.completed_with_error);
     }
+  }
+}
 
-    command.is_active = false;
+static modem_status_t start_unsolicited_response(uint8_t file_id, uint32_t offset, uint32_t length, uint8_t* data,
+                                                 session_config_t* session_config, const alp_query_t* query,
+                                                 modem_priority_t priority, bool wait);
+
+static void airtime_timeout(void* arg) {
+  (void)arg;
+  modem_dispatch_wakeup();
+}
+
+static xtimer_t airtime_timer = { .callback = &airtime_timeout };
+
+// executed by the dispatch worker whenever it is idle, sends the next queued uplink when no command is active
+static void drain_uplinks(void) {
+  session_config_t* session_config = modem_uplink_get_session_config();
+  if(session_config == NULL || command.is_active)
+    return;
+
+  uint32_t delay = modem_scheduler_get_delay_us(modem_scheduler_get_bucket(session_config));
+  if(delay > 0) {
+    xtimer_set(&airtime_timer, delay); // retry when the uplink will be accepted
+    return;
   }
+
+  static modem_uplink_t uplink; // only used by the worker, data should stay valid until it is transferred
+  if(!modem_uplink_take(&uplink))
+    return;
+
+  modem_status_t status = start_unsolicited_response(uplink.file_id, uplink.offset, uplink.length, uplink.data, session_config, NULL,
+                                                     uplink.priority, false);
+  if(status == MODEM_STATUS_BUSY || status == MODEM_STATUS_DUTY_CYCLE_LIMITED) {
+    modem_uplink_release(); // we are woken up again when the command completes, or by the airtime timer
+    if(status == MODEM_STATUS_DUTY_CYCLE_LIMITED)
+      xtimer_set(&airtime_timer, modem_scheduler_get_delay_us(modem_scheduler_get_bucket(session_config)));
+
+    return;
+  } else if(status != MODEM_STATUS_COMMAND_PROCESSING) {
+    modem_uplink_done(false);
+    return;
+  }
+
+  command.is_uplink = true;
+  modem_batch_send_async();
 }
 
 void modem_cb_init(modem_callbacks_t* cbs)
@@ -120,14 +709,54 @@ void modem_cb_init(modem_callbacks_t* cbs)
     callbacks = cbs;
 }
 
+// fails the async command for which the timer expired, this releases the command slot (and the uplink in flight)
+static void expire_async_command(void) {
+  if(!command_expired)
+    return;
+
+  command_expired = false;
+  if(!command.is_active || command.is_completed || command.execute_synchronuous || transfer.active
+     || command.tag_id != expired_tag_id)
+    return; // completed in the meantime
+
+  DPRINT("!!! timeout for async command with tag %i\n", command.tag_id);
+  modem_trace_complete(&command.trace);
+  complete_async_command(true);
+}
+
+// executed by the dispatch worker whenever it is idle
+static void run_background_tasks(void) {
+  expire_async_command();
+  modem_watchdog_run();
+  modem_sample_batch_run();
+  drain_uplinks();
+}
+
+static void on_health_changed(bool alive) {
+  if(callbacks && callbacks->health_callback)
+    callbacks->health_callback(alive);
+}
+
 void modem_init(uint8_t uart_idx, uint32_t baudrate)
 {
+  modem_watchdog_init(&on_health_changed);
+  modem_dispatch_init(&dispatch_event, &run_background_tasks);
   modem_interface_init(uart_idx, baudrate, 0, 0); // TODO pins
   modem_interface_register_handler(&process_serial_frame, SERIAL_MESSAGE_TYPE_ALP_DATA);
+  modem_interface_register_handler(&modem_watchdog_process_ping_response, SERIAL_MESSAGE_TYPE_PING_RESPONSE);
 }
 
 void modem_reinit(void) {
-  command.is_active = false;
+  modem_interface_reset();
+  mutex_lock(&slot_mutex);
+  bool abort = command.is_active && !cancel_command();
+  mutex_unlock(&slot_mutex);
+  if(!abort)
+    return;
+
+  // complete the async command with an error, nobody else will
+  DPRINT("aborting command\n");
+  complete_async_command(true);
 }
 
 void modem_send_ping(void) {
@@ -139,44 +768,111 @@ void modem_execute_raw_alp(uint8_t* alp, uint8_t len) {
   modem_interface_transfer_bytes(alp, len, SERIAL_MESSAGE_TYPE_ALP_DATA);
 }
 
-bool alloc_command(void) {
-  if(command.is_active) {
+// sync commands wait for the response, which is never processed when waiting on the thread handling the modem events
+static bool can_block(void) {
+  if(!modem_dispatch_in_event_thread())
+    return true;
+
+  DPRINT("!!! sync command from the modem event thread, use the async API instead\n");
+  return false;
+}
+
+static bool alloc_command_prio(modem_priority_t priority) {
+  uint32_t submit_timestamp = xtimer_now_usec();
+  if(!acquire_command_slot(priority)) {
     //DPRINT("prev command still active @ %i", timer_get_counter_value());
     DPRINT("prev command still active\n");
     return false;
   }
 
-  command.is_active = true;
+  command.completion_reserved = false; // cleared before releasing the slot below
+  if(!modem_dispatch_reserve_completion()) {
+    release_command(); // too many completions are not delivered yet
+    return false;
+  }
+
+  command.completion_reserved = true;
+
+  command.is_completed = false;
+  command.cancel_requested = false;
   command.execute_synchronuous = false;
+  command.is_forwarded = false;
+  command.is_uplink = false;
+  command.airtime_bucket = MODEM_SCHEDULER_NO_BUCKET;
+  command.has_target_uid = false;
+  command.read_req_count = 0;
+  command.collector = NULL;
+  command.file_header = NULL;
+  command.file_header_received = false;
+  command.stream_responses = false;
+  command.has_last_status = false;
   command.completed_with_error = false;
   fifo_init(&command.fifo, command.buffer, CMD_BUFFER_SIZE);
   command.tag_id = next_tag_id;
   next_tag_id++;
+  memset(&command.trace, 0, sizeof(command.trace));
+  command.trace.tag_id = command.tag_id;
+  command.trace.itf = MODEM_TRACE_ITF_LOCAL;
+  command.trace.timestamps[MODEM_TRACE_SUBMIT] = submit_timestamp;
 
   alp_append_tag_request_action(&command.fifo, command.tag_id, true);
   return true;
 }
 
+bool alloc_command(void) {
+  return alloc_command_prio(MODEM_PRIORITY_DEFAULT);
+}
+
 static modem_status_t block_until_cmd_completed(uint32_t timeout_ms) {
   // lock first and try to lock again with timeout, should block until ready, or timeout
   mutex_lock(&cmd_mutex);
-  int timeout = xtimer_mutex_lock_timeout(&cmd_mutex, timeout_ms * 1000);
+  int timeout = 0;
+  if(!command.is_completed && !command.cancel_requested) // the response might be received already
+    timeout = xtimer_mutex_lock_timeout(&cmd_mutex, timeout_ms * 1000);
+
 	mutex_unlock(&cmd_mutex);
-  if(!timeout) {
-		command.is_active = false;
-    if(command.completed_with_error)
-      return MODEM_STATUS_COMMAND_COMPLETED_ERROR;
-    else
-      return MODEM_STATUS_COMMAND_COMPLETED_SUCCESS;
-	} else {
+  modem_status_t status;
+  if(command.cancel_requested && !command.is_completed) {
+    DPRINT("command cancelled\n");
+    status = MODEM_STATUS_COMMAND_CANCELLED;
+  } else if(timeout) {
     DPRINT("!!! timeout, unlocking\n");
-    return MODEM_STATUS_COMMAND_TIMEOUT;
+    status = MODEM_STATUS_COMMAND_TIMEOUT; // a late response is ignored, since the tag will not match anymore
+  } else if(command.completed_with_error) {
+    status = MODEM_STATUS_COMMAND_COMPLETED_ERROR;
+  } else if(command.file_header && !command.file_header_received) {
+    status = MODEM_STATUS_NOT_RETURNED; // the caller should not use (or write back) the uninitialized header
+  } else {
+    status = MODEM_STATUS_COMMAND_COMPLETED_SUCCESS;
   }
+
+  if(command.is_completed) {
+    modem_trace_delivered(command.tag_id);
+  } else {
+    command.trace.cancelled = status == MODEM_STATUS_COMMAND_CANCELLED;
+    modem_trace_complete(&command.trace); // timed out or cancelled, so it shows up in the trace as well
+  }
+
+  release_command();
+  return status;
+}
+
+// transmits (a part of) the active command, registering the TX timestamps
+static void transmit_command(uint8_t* part1, uint8_t part1_length, uint8_t* part2, uint8_t part2_length) {
+  if(!command.execute_synchronuous) {
+    // armed before transmitting, the response might be processed before we return
+    command_timer.arg = (void*)(uintptr_t)command.tag_id;
+    xtimer_set(&command_timer, CMD_TIMEOUT_MS * US_PER_MS);
+  }
+
+  modem_interface_transfer_parts_timed(part1, part1_length, part2, part2_length, SERIAL_MESSAGE_TYPE_ALP_DATA,
+                                       &command.trace.timestamps[MODEM_TRACE_TX_START],
+                                       &command.trace.timestamps[MODEM_TRACE_TX_END]);
 }
 
 static void send_read_file(uint8_t file_id, uint32_t offset, uint32_t size) {
 	alp_append_read_file_data_action(&command.fifo, file_id, offset, size, true, false);
-  modem_interface_transfer_bytes(command.buffer, fifo_get_size(&command.fifo), SERIAL_MESSAGE_TYPE_ALP_DATA);
+  transmit_command(command.buffer, fifo_get_size(&command.fifo), NULL, 0);
 }
 
 // TODO can be removed later?
@@ -189,14 +885,85 @@ modem_status_t modem_read_file_async(uint8_t file_id, uint32_t offset, uint32_t
 }
 
 modem_status_t modem_read_file(uint8_t file_id, uint32_t offset, uint32_t size, uint8_t* response_buffer) {
+  modem_read_req_t req = {
+    .file_id = file_id,
+    .offset = offset,
+    .size = size,
+    .buffer = response_buffer
+  };
+
+  return modem_read_files(&req, 1);
+}
+
+modem_status_t modem_read_files(const modem_read_req_t* reqs, uint8_t count) {
+  if(!can_block())
+    return MODEM_STATUS_WOULD_BLOCK;
+
+  // remember the cache hits, so every request is only looked up once
+  uint8_t cached[(UINT8_MAX + 1) / 8] = { 0 };
+  uint8_t filled[(UINT8_MAX + 1) / 8]; // the cache hits, and the requests completely returned by the modem
+  uint8_t cached_count = 0;
+  for(uint8_t i = 0; i < count; i++) {
+    if(modem_cache_lookup(reqs[i].file_id, reqs[i].offset, reqs[i].size, reqs[i].buffer)) {
+      cached[i / 8] |= 1 << (i % 8);
+      cached_count++;
+    }
+  }
+
+  if(cached_count == count)
+    return MODEM_STATUS_COMMAND_COMPLETED_SUCCESS;
+
   if(!alloc_command())
     return MODEM_STATUS_BUSY;
 
+  // all reads are packed in one command, only the reads not served by the cache are requested
+  for(uint8_t i = 0; i < count; i++) {
+    if(cached[i / 8] & (1 << (i % 8)))
+      continue;
+
+    if(alp_append_read_file_data_action(&command.fifo, reqs[i].file_id, reqs[i].offset, reqs[i].size, true, false) != SUCCESS) {
+      release_command();
+      return MODEM_STATUS_COMMAND_TOO_LARGE;
+    }
+  }
+
+  // the response (tag response and all returned file data) should fit in one serial frame
+  if(ALP_OP_SIZE_REQUEST_TAG + alp_get_expected_response_length(command.buffer, fifo_get_size(&command.fifo)) > MODEM_RESPONSE_MAX_SIZE) {
+    release_command();
+    return MODEM_STATUS_COMMAND_TOO_LARGE;
+  }
+
+  memcpy(filled, cached, sizeof(filled));
   command.execute_synchronuous = true;
-  command.response_buffer = response_buffer;
+  command.read_reqs = reqs;
+  command.read_req_count = count;
+  command.read_filled = filled;
+  transmit_command(command.buffer, fifo_get_size(&command.fifo), NULL, 0);
+  modem_status_t status = block_until_cmd_completed(CMD_TIMEOUT_MS); // late responses are not scattered anymore
+  for(uint8_t i = 0; i < count && status == MODEM_STATUS_COMMAND_COMPLETED_SUCCESS; i++) {
+    if(!(filled[i / 8] & (1 << (i % 8))))
+      status = MODEM_STATUS_NOT_RETURNED; // the buffer is not (completely) initialized
+  }
 
-	send_read_file(file_id, offset, size);
-  return block_until_cmd_completed(CMD_TIMEOUT_MS);
+  if(status == MODEM_STATUS_COMMAND_COMPLETED_SUCCESS || status == MODEM_STATUS_NOT_RETURNED) {
+    // only the data the modem returned completely is cached, the other buffers are (partially) uninitialized
+    for(uint8_t i = 0; i < count; i++) {
+      if((filled[i / 8] & (1 << (i % 8))) && !(cached[i / 8] & (1 << (i % 8))))
+        modem_cache_store(reqs[i].file_id, reqs[i].offset, reqs[i].size, reqs[i].buffer);
+    }
+  }
+
+  return status;
+}
+
+static bool send_write_file(uint8_t file_id, uint32_t offset, uint32_t size, uint8_t* data) {
+  if(alp_append_write_file_data_action(&command.fifo, file_id, offset, size, data, true, false) != SUCCESS) {
+    release_command();
+    return false;
+  }
+
+  transmit_command(command.buffer, fifo_get_size(&command.fifo), NULL, 0);
+  return true;
 }
 
 // TODO can be removed later?
@@ -204,28 +971,595 @@ modem_status_t modem_write_file_async(uint8_t file_id, uint32_t offset, uint32_t
   if(!alloc_command())
     return MODEM_STATUS_BUSY;
 
-  alp_append_write_file_data_action(&command.fifo, file_id, offset, size, data, true, false);
-
-  modem_interface_transfer_bytes(command.buffer, fifo_get_size(&command.fifo), SERIAL_MESSAGE_TYPE_ALP_DATA);
+  if(!send_write_file(file_id, offset, size, data))
+    return MODEM_STATUS_COMMAND_TOO_LARGE;
 
+  modem_cache_invalidate_range(file_id, offset, size); // result is not known here
   return MODEM_STATUS_COMMAND_PROCESSING;
 }
 
-modem_status_t modem_send_unsolicited_response(uint8_t file_id, uint32_t offset, uint32_t length, uint8_t* data,
-                                     session_config_t* session_config) {
+modem_status_t modem_write_file(uint8_t file_id, uint32_t offset, uint32_t size, uint8_t* data) {
+  if(!can_block())
+    return MODEM_STATUS_WOULD_BLOCK;
+
+  if(!alloc_command())
+    return MODEM_STATUS_BUSY;
+
+  command.execute_synchronuous = true;
+  if(!send_write_file(file_id, offset, size, data))
+    return MODEM_STATUS_COMMAND_TOO_LARGE;
+
+  modem_status_t status = block_until_cmd_completed(CMD_TIMEOUT_MS);
+  if(status == MODEM_STATUS_COMMAND_COMPLETED_SUCCESS)
+    modem_cache_write(file_id, offset, size, data);
+  else
+    modem_cache_invalidate_range(file_id, offset, size); // might be partially written
+
+  return status;
+}
+
+modem_status_t modem_read_file_header(uint8_t file_id, fs_file_header_t* file_header) {
+  if(!can_block())
+    return MODEM_STATUS_WOULD_BLOCK;
+
   if(!alloc_command())
     return MODEM_STATUS_BUSY;
 
-  if(session_config->interface_type==DASH7)
-    alp_append_forward_action(&command.fifo, ALP_ITF_ID_D7ASP, (uint8_t *) &session_config->d7ap_session_config, sizeof(d7ap_session_config_t));
-  else if(session_config->interface_type==LORAWAN_OTAA)
-    alp_append_forward_action(&command.fifo, ALP_ITF_ID_LORAWAN_OTAA, (uint8_t *) &session_config->lorawan_session_config_otaa, sizeof(lorawan_session_config_otaa_t));
-  else if(session_config->interface_type==lorawan_ABP)
-    alp_append_forward_action(&command.fifo, ALP_ITF_ID_LORAWAN_ABP, (uint8_t *) &session_config->lorawan_session_config_abp, sizeof(lorawan_session_config_abp_t));
+  alp_append_read_file_properties_action(&command.fifo, file_id, true, false);
+  command.execute_synchronuous = true;
+  command.file_header_file_id = file_id;
+  command.file_header = file_header;
+  transmit_command(command.buffer, fifo_get_size(&command.fifo), NULL, 0);
+  return block_until_cmd_completed(CMD_TIMEOUT_MS);
+}
+
+modem_status_t modem_write_file_header(uint8_t file_id, fs_file_header_t* file_header) {
+  if(!can_block())
+    return MODEM_STATUS_WOULD_BLOCK;
+
+  if(!alloc_command())
+    return MODEM_STATUS_BUSY;
+
+  alp_append_write_file_properties_action(&command.fifo, file_id, file_header, true, false);
+  command.execute_synchronuous = true;
+  transmit_command(command.buffer, fifo_get_size(&command.fifo), NULL, 0);
+  modem_status_t status = block_until_cmd_completed(CMD_TIMEOUT_MS);
+  modem_cache_invalidate(file_id); // the length might have changed
+  return status;
+}
+
+modem_status_t modem_enable_action_protocol(uint8_t file_id, alp_act_condition_t condition, uint8_t alp_cmd_file_id,
+                                            uint8_t* alp_cmd, uint8_t alp_cmd_length, uint8_t interface_file_id) {
+  fs_file_header_t file_header;
+  modem_status_t status = modem_read_file_header(file_id, &file_header);
+  if(status != MODEM_STATUS_COMMAND_COMPLETED_SUCCESS)
+    return status;
+
+  uint8_t cmd[ALP_OP_SIZE_READ_FILE_DATA + 1];
+  if(alp_cmd == NULL) {
+    // default command: return the complete file
+    fifo_t fifo;
+    fifo_init(&fifo, cmd, sizeof(cmd));
+    alp_append_read_file_data_action(&fifo, file_id, 0, file_header.length, true, false);
+    alp_cmd = cmd;
+    alp_cmd_length = fifo_get_size(&fifo);
+  }
+
+  status = modem_write_file(alp_cmd_file_id, 0, alp_cmd_length, alp_cmd);
+  if(status != MODEM_STATUS_COMMAND_COMPLETED_SUCCESS)
+    return status;
+
+  file_header.file_properties.action_protocol_enabled = true;
+  file_header.file_properties.action_condition = condition;
+  file_header.alp_cmd_file_id = alp_cmd_file_id;
+  file_header.interface_file_id = interface_file_id;
+  return modem_write_file_header(file_id, &file_header);
+}
+
+modem_status_t modem_disable_action_protocol(uint8_t file_id) {
+  fs_file_header_t file_header;
+  modem_status_t status = modem_read_file_header(file_id, &file_header);
+  if(status != MODEM_STATUS_COMMAND_COMPLETED_SUCCESS)
+    return status;
+
+  file_header.file_properties.action_protocol_enabled = false;
+  return modem_write_file_header(file_id, &file_header);
+}
+
+static alp_itf_id_t get_itf_id(session_config_t* session_config) {
+  switch(session_config->interface_type) {
+    case DASH7:
+      return ALP_ITF_ID_D7ASP;
+    case LORAWAN_OTAA:
+      return ALP_ITF_ID_LORAWAN_OTAA;
+    case lorawan_ABP:
+      return ALP_ITF_ID_LORAWAN_ABP;
+    case INTERFACE_FILE:
+      break; // no interface config on the host
+  }
+
+  assert(false);
+  return ALP_ITF_ID_HOST;
+}
+
+static uint8_t* get_itf_config(session_config_t* session_config) {
+  switch(session_config->interface_type) {
+    case DASH7:
+      return (uint8_t*) &session_config->d7ap_session_config;
+    case LORAWAN_OTAA:
+      return (uint8_t*) &session_config->lorawan_session_config_otaa;
+    case lorawan_ABP:
+      return (uint8_t*) &session_config->lorawan_session_config_abp;
+    case INTERFACE_FILE:
+      break; // no interface config on the host
+  }
+
+  assert(false);
+  return NULL;
+}
+
+static modem_trace_itf_t get_trace_itf(session_config_t* session_config) {
+  switch(session_config->interface_type) {
+    case DASH7:
+      return MODEM_TRACE_ITF_D7;
+    case LORAWAN_OTAA:
+    case lorawan_ABP:
+      return MODEM_TRACE_ITF_LORAWAN;
+    default:
+      return MODEM_TRACE_ITF_FILE;
+  }
+}
+
+static error_t append_forward(fifo_t* fifo, session_config_t* session_config) {
+  if(session_config->interface_type == INTERFACE_FILE)
+    return alp_append_indirect_forward_action(fifo, session_config->interface_file_id);
+
+  // the config length is only used for interfaces unknown by the ALP encoder
+  return alp_append_forward_action(fifo, get_itf_id(session_config), get_itf_config(session_config), 0);
+}
+
+modem_status_t modem_register_session(uint8_t interface_file_id, session_config_t* session_config, session_config_t* handle) {
+  assert(session_config->interface_type != INTERFACE_FILE);
+  uint8_t interface_config[MODEM_INTERFACE_CONFIG_MAX_SIZE];
+  fifo_t fifo;
+  fifo_init(&fifo, interface_config, sizeof(interface_config));
+  alp_append_interface_config(&fifo, get_itf_id(session_config), get_itf_config(session_config), 0);
+
+  modem_status_t status = modem_write_file(interface_file_id, 0, fifo_get_size(&fifo), interface_config);
+  if(status == MODEM_STATUS_COMMAND_COMPLETED_SUCCESS) {
+    handle->interface_type = INTERFACE_FILE;
+    handle->interface_file_id = interface_file_id;
+  }
+
+  return status;
+}
+
+// returns the UID of the addressee, or NULL when the session is not unicasted to a D7 node using its UID
+static uint8_t* get_target_uid(session_config_t* session_config) {
+  if(session_config->interface_type != DASH7 || session_config->d7ap_session_config.addressee.ctrl.id_type != ID_TYPE_UID)
+    return NULL;
+
+  return session_config->d7ap_session_config.addressee.id;
+}
+
+static void transfer_command(uint8_t* payload, uint8_t payload_length) {
+  if(command.has_target_uid)
+    modem_link_table_add_request(command.target_uid);
+
+  if(command.airtime_bucket != MODEM_SCHEDULER_NO_BUCKET) {
+    // all actions after the forward action are transmitted by the modem
+    uint8_t forwarded_length = fifo_get_size(&command.fifo) - command.forwarded_offset + payload_length;
+    modem_scheduler_consume(command.airtime_bucket,
+                            modem_scheduler_estimate_airtime_us(command.airtime_bucket, command.session_config, forwarded_length));
+  }
+
+  transmit_command(command.buffer, fifo_get_size(&command.fifo), payload, payload_length);
+}
+
+// the actions appended after this are forwarded over the interface in session_config (when not NULL), their airtime is
+// charged to the duty cycle bucket of the interface when transferred
+static void append_session(session_config_t* session_config) {
+  command.is_forwarded = session_config != NULL;
+  if(command.is_forwarded) {
+    append_forward(&command.fifo, session_config);
+    command.forwarded_offset = fifo_get_size(&command.fifo);
+    command.session_config = session_config;
+    command.airtime_bucket = modem_scheduler_get_bucket(session_config);
+    command.trace.itf = get_trace_itf(session_config);
+    uint8_t* target_uid = get_target_uid(session_config);
+    if(target_uid) {
+      command.has_target_uid = true;
+      memcpy(command.target_uid, target_uid, D7A_FILE_UID_SIZE);
+    }
+  }
+}
+
+// waits until the duty cycle limits of the interface allow a transmission, or returns false when wait is not set
+static bool wait_for_airtime(uint8_t bucket, bool wait) {
+  uint32_t delay = modem_scheduler_get_delay_us(bucket);
+  if(delay == 0)
+    return true;
+
+  if(!wait)
+    return false;
+
+  DPRINT("duty cycle limited, waiting %u ms\n", (unsigned)(delay / US_PER_MS));
+  xtimer_usleep(delay);
+  return true;
+}
+
+static uint8_t get_airtime_bucket(session_config_t* session_config) {
+  return session_config ? modem_scheduler_get_bucket(session_config) : MODEM_SCHEDULER_NO_BUCKET; // local commands are not limited
+}
+
+// acquires the command slot, when the duty cycle limits of the interface allow a transmission. The budget is checked
+// again while holding the slot, since airtime is only consumed by the command holding the slot.
+static modem_status_t alloc_command_with_airtime(uint8_t bucket, modem_priority_t priority, bool wait) {
+  while(true) {
+    if(!wait_for_airtime(bucket, wait)) // before claiming the command slot
+      return MODEM_STATUS_DUTY_CYCLE_LIMITED;
+
+    if(!alloc_command_prio(priority))
+      return MODEM_STATUS_BUSY;
+
+    if(modem_scheduler_get_delay_us(bucket) == 0)
+      return MODEM_STATUS_COMMAND_PROCESSING;
+
+    release_command(); // spent by another command in the meantime
+  }
+}
+
+bool modem_batch_start(session_config_t* session_config) {
+  return modem_batch_start_prio(session_config, MODEM_PRIORITY_DEFAULT);
+}
+
+bool modem_batch_start_prio(session_config_t* session_config, modem_priority_t priority) {
+  if(alloc_command_with_airtime(get_airtime_bucket(session_config), priority, false) != MODEM_STATUS_COMMAND_PROCESSING)
+    return false;
+
+  append_session(session_config);
+  return true;
+}
+
+bool modem_batch_append_query(const alp_query_t* query) {
+  assert(command.is_active);
+  return alp_append_action_query_action(&command.fifo, query) == SUCCESS;
+}
+
+bool modem_batch_append_write(uint8_t file_id, uint32_t offset, uint32_t length, uint8_t* data) {
+  assert(command.is_active);
+  if(alp_append_write_file_data_action(&command.fifo, file_id, offset, length, data, true, false) != SUCCESS)
+    return false;
+
+  if(!command.is_forwarded)
+    modem_cache_invalidate_range(file_id, offset, length);
 
-  alp_append_return_file_data_action(&command.fifo, file_id, offset, length, data);
+  return true;
+}
+
+bool modem_batch_append_return(uint8_t file_id, uint32_t offset, uint32_t length, uint8_t* data) {
+  assert(command.is_active);
+  return alp_append_return_file_data_action(&command.fifo, file_id, offset, length, data) == SUCCESS;
+}
+
+void modem_batch_abort(void) {
+  release_command();
+}
+
+modem_status_t modem_batch_send(void) {
+  assert(command.is_active);
+  if(!can_block()) {
+    release_command();
+    return MODEM_STATUS_WOULD_BLOCK;
+  }
 
   command.execute_synchronuous = true;
-  modem_interface_transfer_bytes(command.buffer, fifo_get_size(&command.fifo), SERIAL_MESSAGE_TYPE_ALP_DATA);
+  transfer_command(NULL, 0);
   return block_until_cmd_completed(CMD_TIMEOUT_MS); // TODO take timeout as param
 }
+
+modem_status_t modem_batch_send_async(void) {
+  assert(command.is_active);
+  transfer_command(NULL, 0);
+  return MODEM_STATUS_COMMAND_PROCESSING;
+}
+
+static modem_status_t start_collect_file(session_config_t* session_config, const alp_query_t* query, uint8_t file_id,
+                                        uint32_t offset, uint32_t size, bool wait) {
+  modem_status_t status = alloc_command_with_airtime(get_airtime_bucket(session_config), MODEM_PRIORITY_DEFAULT, wait);
+  if(status != MODEM_STATUS_COMMAND_PROCESSING)
+    return status;
+
+  append_session(session_config);
+
+  if(query && !modem_batch_append_query(query)) { // evaluated by every addressed node, only matching nodes respond
+    modem_batch_abort();
+    return MODEM_STATUS_COMMAND_TOO_LARGE;
+  }
+
+  // the response of every responder should fit in one serial frame, the expected length includes its interface status
+  if(alp_append_read_file_data_action(&command.fifo, file_id, offset, size, true, false) != SUCCESS
+     || ALP_OP_SIZE_REQUEST_TAG + alp_get_expected_response_length(command.buffer, fifo_get_size(&command.fifo)) > MODEM_RESPONSE_MAX_SIZE) {
+    modem_batch_abort();
+    return MODEM_STATUS_COMMAND_TOO_LARGE;
+  }
+
+  return MODEM_STATUS_COMMAND_PROCESSING;
+}
+
+modem_status_t modem_collect_file(session_config_t* session_config, uint8_t file_id, uint32_t offset, uint32_t size,
+                                  modem_response_collector_t* collector) {
+  return modem_collect_file_filtered(session_config, NULL, file_id, offset, size, collector);
+}
+
+modem_status_t modem_collect_file_async(session_config_t* session_config, uint8_t file_id, uint32_t offset, uint32_t size) {
+  return modem_collect_file_filtered_async(session_config, NULL, file_id, offset, size);
+}
+
+modem_status_t modem_collect_file_filtered(session_config_t* session_config, const alp_query_t* query, uint8_t file_id,
+                                           uint32_t offset, uint32_t size, modem_response_collector_t* collector) {
+  if(!can_block())
+    return MODEM_STATUS_WOULD_BLOCK;
+
+  modem_status_t status = start_collect_file(session_config, query, file_id, offset, size, true);
+  if(status != MODEM_STATUS_COMMAND_PROCESSING)
+    return status;
+
+  command.collector = collector;
+  return modem_batch_send();
+}
+
+modem_status_t modem_collect_file_filtered_async(session_config_t* session_config, const alp_query_t* query, uint8_t file_id,
+                                                 uint32_t offset, uint32_t size) {
+  modem_status_t status = start_collect_file(session_config, query, file_id, offset, size, false);
+  if(status != MODEM_STATUS_COMMAND_PROCESSING)
+    return status;
+
+  command.stream_responses = true;
+  return modem_batch_send_async();
+}
+
+// the size of the return file data action as transmitted
+static uint8_t get_response_payload_length(uint32_t offset, uint32_t length) {
+  return 2 + alp_length_operand_coded_length(offset) + alp_length_operand_coded_length(length) + length;
+}
+
+static modem_status_t start_unsolicited_response(uint8_t file_id, uint32_t offset, uint32_t length, uint8_t* data,
+                                                 session_config_t* session_config, const alp_query_t* query,
+                                                 modem_priority_t priority, bool wait) {
+  modem_status_t status = alloc_command_with_airtime(get_airtime_bucket(session_config), priority, wait);
+  if(status != MODEM_STATUS_COMMAND_PROCESSING)
+    return status;
+
+  if(query && alp_append_break_query_action(&command.fifo, query) != SUCCESS) { // evaluated by the modem, before forwarding
+    modem_batch_abort();
+    return MODEM_STATUS_COMMAND_TOO_LARGE;
+  }
+
+  append_session(session_config);
+  if(!modem_batch_append_return(file_id, offset, length, data)) {
+    modem_batch_abort();
+    return MODEM_STATUS_COMMAND_TOO_LARGE;
+  }
+
+  return MODEM_STATUS_COMMAND_PROCESSING;
+}
+
+modem_status_t modem_send_unsolicited_response(uint8_t file_id, uint32_t offset, uint32_t length, uint8_t* data,
+                                     session_config_t* session_config) {
+  return modem_send_unsolicited_response_filtered(file_id, offset, length, data, session_config, NULL);
+}
+
+modem_status_t modem_send_unsolicited_response_async(uint8_t file_id, uint32_t offset, uint32_t length, uint8_t* data,
+                                     session_config_t* session_config) {
+  return modem_send_unsolicited_response_filtered_async(file_id, offset, length, data, session_config, NULL);
+}
+
+modem_status_t modem_send_unsolicited_response_filtered(uint8_t file_id, uint32_t offset, uint32_t length, uint8_t* data,
+                                                        session_config_t* session_config, const alp_query_t* query) {
+  if(!can_block())
+    return MODEM_STATUS_WOULD_BLOCK;
+
+  modem_status_t status = start_unsolicited_response(file_id, offset, length, data, session_config, query,
+                                                     MODEM_PRIORITY_DEFAULT, true);
+  if(status != MODEM_STATUS_COMMAND_PROCESSING)
+    return status;
+
+  return modem_batch_send();
+}
+
+modem_status_t modem_send_unsolicited_response_filtered_async(uint8_t file_id, uint32_t offset, uint32_t length, uint8_t* data,
+                                                              session_config_t* session_config, const alp_query_t* query) {
+  modem_status_t status = start_unsolicited_response(file_id, offset, length, data, session_config, query,
+                                                     MODEM_PRIORITY_DEFAULT, false);
+  if(status != MODEM_STATUS_COMMAND_PROCESSING)
+    return status;
+
+  return modem_batch_send_async();
+}
+
+bool modem_prepare_unsolicited_response(modem_prepared_command_t* prepared, uint8_t file_id, uint32_t offset, uint32_t length,
+                                        session_config_t* session_config) {
+  prepared->header_length = 0; // sending fails until the command is prepared successfully
+  fifo_t fifo;
+  fifo_init(&fifo, prepared->header, sizeof(prepared->header));
+  alp_append_tag_request_action(&fifo, 0, true); // tag ID is filled in on every send
+  if(append_forward(&fifo, session_config) != SUCCESS
+     || alp_append_return_file_data_header(&fifo, file_id, offset, length) != SUCCESS) // data is appended on every send
+    return false;
+
+  uint8_t* target_uid = get_target_uid(session_config);
+  prepared->has_target_uid = target_uid != NULL;
+  if(target_uid)
+    memcpy(prepared->target_uid, target_uid, D7A_FILE_UID_SIZE);
+
+  if(fifo_get_size(&fifo) + length > MODEM_RESPONSE_MAX_SIZE)
+    return false;
+
+  prepared->header_length = fifo_get_size(&fifo);
+
+  prepared->data_length = length;
+  prepared->priority = MODEM_PRIORITY_DEFAULT;
+  prepared->trace_itf = get_trace_itf(session_config);
+  prepared->airtime_bucket = modem_scheduler_get_bucket(session_config);
+  if(prepared->airtime_bucket != MODEM_SCHEDULER_NO_BUCKET)
+    prepared->airtime_us = modem_scheduler_estimate_airtime_us(prepared->airtime_bucket, session_config, get_response_payload_length(offset, length));
+
+  return true;
+}
+
+static modem_status_t start_prepared_command(modem_prepared_command_t* prepared, bool wait) {
+  if(prepared->header_length == 0)
+    return MODEM_STATUS_COMMAND_TOO_LARGE; // preparing the command failed
+
+  modem_status_t status = alloc_command_with_airtime(prepared->airtime_bucket, prepared->priority, wait);
+  if(status != MODEM_STATUS_COMMAND_PROCESSING)
+    return status;
+
+  command.trace.itf = prepared->trace_itf;
+  modem_scheduler_consume(prepared->airtime_bucket, prepared->airtime_us);
+
+  prepared->header[1] = command.tag_id; // the tag request is the first action
+  command.is_forwarded = true;
+  command.has_target_uid = prepared->has_target_uid;
+  if(command.has_target_uid) {
+    memcpy(command.target_uid, prepared->target_uid, D7A_FILE_UID_SIZE);
+    modem_link_table_add_request(command.target_uid);
+  }
+
+  return MODEM_STATUS_COMMAND_PROCESSING;
+}
+
+modem_status_t modem_send_prepared_command(modem_prepared_command_t* prepared, uint8_t* data) {
+  if(!can_block())
+    return MODEM_STATUS_WOULD_BLOCK;
+
+  modem_status_t status = start_prepared_command(prepared, true);
+  if(status != MODEM_STATUS_COMMAND_PROCESSING)
+    return status;
+
+  command.execute_synchronuous = true;
+  transmit_command(prepared->header, prepared->header_length, data, prepared->data_length);
+  return block_until_cmd_completed(CMD_TIMEOUT_MS);
+}
+
+modem_status_t modem_send_prepared_command_async(modem_prepared_command_t* prepared, uint8_t* data) {
+  modem_status_t status = start_prepared_command(prepared, false);
+  if(status != MODEM_STATUS_COMMAND_PROCESSING)
+    return status;
+
+  transmit_command(prepared->header, prepared->header_length, data, prepared->data_length);
+  return MODEM_STATUS_COMMAND_PROCESSING;
+}
+
+static uint16_t get_chunk_length(uint16_t chunk) {
+  uint32_t remaining = transfer.size - chunk * MODEM_TRANSFER_CHUNK_SIZE;
+  return remaining < MODEM_TRANSFER_CHUNK_SIZE ? remaining : MODEM_TRANSFER_CHUNK_SIZE;
+}
+
+static void send_transfer_chunk(uint16_t chunk, modem_transfer_source_t source, void* arg) {
+  uint32_t offset = transfer.offset + chunk * MODEM_TRANSFER_CHUNK_SIZE;
+  uint16_t length = get_chunk_length(chunk);
+  alp_chunk_step_t step = ALP_CHUNK_STEP_CONTINUE;
+  if(chunk == 0)
+    step |= ALP_CHUNK_STEP_START;
+
+  if(chunk == transfer.chunk_count - 1)
+    step |= ALP_CHUNK_STEP_END;
+
+  uint8_t header[ALP_OP_SIZE_CHUNK + ALP_OP_SIZE_REQUEST_TAG + ALP_OP_SIZE_READ_FILE_DATA + 1];
+  fifo_t fifo;
+  fifo_init(&fifo, header, sizeof(header));
+  alp_append_chunk_action(&fifo, step);
+  alp_append_tag_request_action(&fifo, transfer.first_tag_id + chunk, true);
+  transfer.last_sent_tag_id = transfer.first_tag_id + chunk;
+  if(transfer.is_read) {
+    transfer.chunk_length[chunk % MODEM_TRANSFER_WINDOW] = 0; // the slot is free, the previous chunk in it is delivered
+    alp_append_read_file_data_action(&fifo, transfer.file_id, offset, length, true, false);
+    modem_interface_transfer_bytes(header, fifo_get_size(&fifo), SERIAL_MESSAGE_TYPE_ALP_DATA);
+  } else {
+    // the action header is encoded in the fifo, the data is fetched from the source and sent as second part
+    uint8_t data[MODEM_TRANSFER_CHUNK_SIZE];
+    source(offset - transfer.offset, data, length, arg);
+    alp_append_write_file_data_header(&fifo, transfer.file_id, offset, length, true, false);
+    modem_interface_transfer_parts(header, fifo_get_size(&fifo), data, length, SERIAL_MESSAGE_TYPE_ALP_DATA);
+  }
+}
+
+// Chunks are sent as separate frames, while at most MODEM_TRANSFER_WINDOW chunks are waiting for their response.
+// The sink is called from the calling thread, in order.
+static modem_status_t run_transfer(bool is_read, uint8_t file_id, uint32_t offset, uint32_t size,
+                                   modem_transfer_sink_t sink, modem_transfer_source_t source, void* arg) {
+  if(!can_block())
+    return MODEM_STATUS_WOULD_BLOCK;
+
+  if(!alloc_command_prio(MODEM_PRIORITY_BULK)) // so it can be cancelled by an urgent command
+    return MODEM_STATUS_BUSY;
+
+  uint16_t chunk_count = (size + MODEM_TRANSFER_CHUNK_SIZE - 1) / MODEM_TRANSFER_CHUNK_SIZE;
+  transfer.is_read = is_read;
+  transfer.failed = false;
+  transfer.file_id = file_id;
+  transfer.offset = offset;
+  transfer.size = size;
+  transfer.chunk_count = chunk_count;
+  transfer.acked = 0;
+  transfer.first_tag_id = next_tag_id;
+  next_tag_id += chunk_count; // reserve a tag ID per chunk
+  mutex_trylock(&transfer_mutex); // clear a stale signal
+  transfer.active = true;
+
+  modem_cache_invalidate_range(file_id, offset, size);
+
+  modem_status_t status = MODEM_STATUS_COMMAND_COMPLETED_SUCCESS;
+  uint16_t sent = 0;
+  uint16_t delivered = 0;
+  while(delivered < chunk_count) {
+    while(sent < chunk_count && sent - delivered < MODEM_TRANSFER_WINDOW) {
+      send_transfer_chunk(sent, source, arg);
+      sent++;
+    }
+
+    if(transfer.acked == delivered && xtimer_mutex_lock_timeout(&transfer_mutex, CMD_TIMEOUT_MS * 1000)) {
+      DPRINT("!!! transfer timeout\n");
+      status = MODEM_STATUS_COMMAND_TIMEOUT;
+      break;
+    }
+
+    if(command.cancel_requested) {
+      status = MODEM_STATUS_COMMAND_CANCELLED;
+      break;
+    }
+
+    if(transfer.failed) {
+      status = MODEM_STATUS_COMMAND_COMPLETED_ERROR;
+      break;
+    }
+
+    for(; delivered < transfer.acked; delivered++) {
+      if(is_read) {
+        uint8_t slot = delivered % MODEM_TRANSFER_WINDOW;
+        if(!sink(delivered * MODEM_TRANSFER_CHUNK_SIZE, transfer.chunk_data[slot], transfer.chunk_length[slot], arg)) {
+          status = MODEM_STATUS_COMMAND_COMPLETED_ERROR; // aborted by the sink
+          break;
+        }
+      }
+    }
+
+    if(status != MODEM_STATUS_COMMAND_COMPLETED_SUCCESS)
+      break;
+  }
+
+  // responses for chunks still in flight are ignored from here on
+  transfer.active = false;
+  release_command();
+  return status;
+}
+
+modem_status_t modem_read_file_stream(uint8_t file_id, uint32_t offset, uint32_t size, modem_transfer_sink_t sink, void* arg) {
+  return run_transfer(true, file_id, offset, size, sink, NULL, arg);
+}
+
+modem_status_t modem_write_file_stream(uint8_t file_id, uint32_t offset, uint32_t size, modem_transfer_source_t source, void* arg) {
+  return run_transfer(false, file_id, offset, size, NULL, source, arg);
+}
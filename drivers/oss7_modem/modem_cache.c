@@ -0,0 +1,143 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2018 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include "modem.h"
+#include "modem_cache.h"
+#include "debug.h"
+#include "mutex.h"
+
+#if MODEM_CACHE_ENTRY_SIZE > UINT16_MAX
+#error "MODEM_CACHE_ENTRY_SIZE does not fit the entry length"
+#endif
+
+typedef struct {
+  bool valid;
+  uint8_t file_id;
+  uint16_t length; // MODEM_CACHE_ENTRY_SIZE may be configured above 255
+  uint32_t offset;
+  uint32_t last_used;
+  uint8_t data[MODEM_CACHE_ENTRY_SIZE];
+} cache_entry_t;
+
+static cache_entry_t entries[MODEM_CACHE_ENTRIES];
+static uint8_t policies[256 / 4]; // 2 bits per file ID, all files are uncached by default
+static uint32_t use_counter = 0;
+static mutex_t cache_mutex = MUTEX_INIT;
+
+static modem_cache_policy_t get_policy(uint8_t file_id) {
+  return (policies[file_id / 4] >> (2 * (file_id % 4))) & 0x03;
+}
+
+static bool overlaps(cache_entry_t* entry, uint8_t file_id, uint32_t offset, uint32_t length) {
+  return entry->valid && entry->file_id == file_id
+      && offset < entry->offset + entry->length && entry->offset < offset + length;
+}
+
+void modem_cache_set_policy(uint8_t file_id, modem_cache_policy_t policy) {
+  mutex_lock(&cache_mutex);
+  policies[file_id / 4] &= ~(0x03 << (2 * (file_id % 4)));
+  policies[file_id / 4] |= (policy & 0x03) << (2 * (file_id % 4));
+  mutex_unlock(&cache_mutex);
+
+  if(policy == MODEM_CACHE_POLICY_UNCACHED)
+    modem_cache_invalidate(file_id);
+}
+
+void modem_cache_invalidate(uint8_t file_id) {
+  modem_cache_invalidate_range(file_id, 0, UINT32_MAX);
+}
+
+void modem_cache_invalidate_range(uint8_t file_id, uint32_t offset, uint32_t length) {
+  if(length > UINT32_MAX - offset)
+    length = UINT32_MAX - offset;
+
+  mutex_lock(&cache_mutex);
+  for(uint8_t i = 0; i < MODEM_CACHE_ENTRIES; i++) {
+    if(overlaps(&entries[i], file_id, offset, length))
+      entries[i].valid = false;
+  }
+
+  mutex_unlock(&cache_mutex);
+}
+
+bool modem_cache_lookup(uint8_t file_id, uint32_t offset, uint32_t length, uint8_t* buffer) {
+  bool hit = false;
+  mutex_lock(&cache_mutex);
+  for(uint8_t i = 0; i < MODEM_CACHE_ENTRIES; i++) {
+    cache_entry_t* entry = &entries[i];
+    if(entry->valid && entry->file_id == file_id
+       && offset >= entry->offset && offset + length <= entry->offset + entry->length) {
+      memcpy(buffer, entry->data + (offset - entry->offset), length);
+      entry->last_used = ++use_counter;
+      hit = true;
+      break;
+    }
+  }
+
+  mutex_unlock(&cache_mutex);
+  return hit;
+}
+
+void modem_cache_store(uint8_t file_id, uint32_t offset, uint32_t length, const uint8_t* data) {
+  if(length > MODEM_CACHE_ENTRY_SIZE)
+    return;
+
+  mutex_lock(&cache_mutex);
+  if(get_policy(file_id) == MODEM_CACHE_POLICY_UNCACHED) {
+    mutex_unlock(&cache_mutex);
+    return;
+  }
+
+  // replace an overlapping entry, a free entry or else the least recently used one
+  cache_entry_t* entry = &entries[0];
+  for(uint8_t i = 0; i < MODEM_CACHE_ENTRIES; i++) {
+    if(overlaps(&entries[i], file_id, offset, length)) {
+      entry = &entries[i];
+      break;
+    }
+
+    if(!entries[i].valid || (entry->valid && entries[i].last_used < entry->last_used))
+      entry = &entries[i];
+  }
+
+  // invalidate remaining overlapping entries, so they can't return stale data
+  for(uint8_t i = 0; i < MODEM_CACHE_ENTRIES; i++) {
+    if(&entries[i] != entry && overlaps(&entries[i], file_id, offset, length))
+      entries[i].valid = false;
+  }
+
+  entry->valid = true;
+  entry->file_id = file_id;
+  entry->offset = offset;
+  entry->length = length;
+  entry->last_used = ++use_counter;
+  memcpy(entry->data, data, length);
+  mutex_unlock(&cache_mutex);
+}
+
+void modem_cache_write(uint8_t file_id, uint32_t offset, uint32_t length, const uint8_t* data) {
+  mutex_lock(&cache_mutex);
+  bool write_through = get_policy(file_id) == MODEM_CACHE_POLICY_WRITE_THROUGH;
+  mutex_unlock(&cache_mutex);
+
+  modem_cache_invalidate_range(file_id, offset, length);
+  if(write_through)
+    modem_cache_store(file_id, offset, length, data);
+}
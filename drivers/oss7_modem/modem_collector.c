@@ -0,0 +1,130 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2018 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "modem_collector.h"
+#include "debug.h"
+#include "fifo.h"
+
+#define DPRINT(...) printf(__VA_ARGS__)
+
+#define INDEX_EMPTY 0xFF
+
+// FNV-1a hash of the addressee ID
+static uint8_t hash(const d7ap_addressee_t* addressee) {
+  uint32_t h = 2166136261u;
+  uint8_t id_len = d7ap_addressee_id_length(addressee->ctrl.id_type);
+  for(uint8_t i = 0; i < id_len; i++) {
+    h ^= addressee->id[i];
+    h *= 16777619u;
+  }
+
+  return (h ^ (h >> 16)) & (MODEM_COLLECTOR_INDEX_SIZE - 1);
+}
+
+static bool same_addressee(const d7ap_addressee_t* a, const d7ap_addressee_t* b) {
+  return a->ctrl.id_type == b->ctrl.id_type
+      && memcmp(a->id, b->id, d7ap_addressee_id_length(a->ctrl.id_type)) == 0;
+}
+
+// returns the index slot of the addressee: either the slot containing it, or the empty slot where it should be inserted
+static uint8_t* lookup_slot(modem_response_collector_t* collector, const d7ap_addressee_t* addressee) {
+  uint8_t slot = hash(addressee);
+  while(collector->index[slot] != INDEX_EMPTY) {
+    if(same_addressee(&collector->responses[collector->index[slot]].status.addressee, addressee))
+      break;
+
+    slot = (slot + 1) & (MODEM_COLLECTOR_INDEX_SIZE - 1); // linear probing
+  }
+
+  return &collector->index[slot];
+}
+
+void modem_collector_init(modem_response_collector_t* collector, modem_response_t* responses, uint8_t max_responses,
+                          uint8_t* data_pool, uint16_t data_pool_size) {
+  assert(max_responses < MODEM_COLLECTOR_INDEX_SIZE); // at least one empty slot is needed to terminate probing
+  collector->responses = responses;
+  collector->max_responses = max_responses;
+  collector->count = 0;
+  collector->data_pool = data_pool;
+  collector->data_pool_size = data_pool_size;
+  collector->data_pool_used = 0;
+  collector->dropped = 0;
+  collector->current = NULL;
+  memset(collector->index, INDEX_EMPTY, sizeof(collector->index));
+}
+
+modem_response_t* modem_collector_find(modem_response_collector_t* collector, const d7ap_addressee_t* addressee) {
+  uint8_t idx = *lookup_slot(collector, addressee);
+  if(idx == INDEX_EMPTY)
+    return NULL;
+
+  return &collector->responses[idx];
+}
+
+void modem_collector_add_status(modem_response_collector_t* collector, const d7ap_session_result_t* result) {
+  uint8_t* slot = lookup_slot(collector, &result->addressee);
+  if(*slot == INDEX_EMPTY) {
+    if(collector->count == collector->max_responses) {
+      DPRINT("!!! response collector full\n");
+      collector->dropped++;
+      collector->current = NULL;
+      return;
+    }
+
+    *slot = collector->count;
+    collector->count++;
+    memset(&collector->responses[*slot], 0, sizeof(modem_response_t));
+  }
+
+  // a responder which responds again (for example after a retry) overwrites its previous status
+  collector->current = &collector->responses[*slot];
+  collector->current->status = *result;
+}
+
+modem_response_t* modem_collector_add_file_data(modem_response_collector_t* collector, const alp_operand_file_data_t* operand) {
+  modem_response_t* response = collector->current;
+  if(response == NULL) {
+    collector->dropped++;
+    return NULL; // no status received for this file data
+  }
+
+  collector->current = NULL;
+  uint32_t length = operand->provided_data_length;
+  // reuse the previous data of this responder if the new data fits, otherwise allocate in the pool
+  if(response->data == NULL || length > response->length) {
+    if(collector->data_pool_used + length > collector->data_pool_size) {
+      DPRINT("!!! response collector data pool full\n");
+      collector->dropped++;
+      response->length = 0;
+      response->data = NULL;
+      return NULL;
+    }
+
+    response->data = collector->data_pool + collector->data_pool_used;
+    collector->data_pool_used += length;
+  }
+
+  response->file_id = operand->file_offset.file_id;
+  response->offset = operand->file_offset.offset;
+  response->length = length;
+  fifo_view_copy(&operand->data, response->data);
+  return response;
+}
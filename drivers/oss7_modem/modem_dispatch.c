@@ -0,0 +1,253 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2018 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "modem.h"
+#include "modem_dispatch.h"
+#include "debug.h"
+#include "errors.h"
+#include "fifo.h"
+#include "mutex.h"
+#include "thread.h"
+#include "xtimer.h"
+
+#define DPRINT(...) printf(__VA_ARGS__)
+
+static modem_dispatch_handler_t dispatch_handler;
+static modem_dispatch_idle_handler_t dispatch_idle_handler;
+static volatile kernel_pid_t worker_pid = KERNEL_PID_UNDEF;
+
+static modem_event_t events[MODEM_DISPATCH_QUEUE_SIZE];
+static uint8_t events_head = 0;
+static uint8_t events_count = 0;
+
+// completions have their own queue, a slot is reserved when the command starts so they are never dropped
+static modem_event_t completions[MODEM_DISPATCH_COMPLETION_QUEUE_SIZE];
+static uint8_t completions_head = 0;
+static uint8_t completions_count = 0;
+static uint8_t completions_reserved = 0;
+
+static uint32_t next_seq = 0; // events of both queues are dispatched in the order they were posted
+
+static uint8_t data_buffer[MODEM_DISPATCH_DATA_BUFFER_SIZE];
+static fifo_t data_fifo;
+
+static uint8_t event_data[MODEM_EVENT_MAX_DATA_SIZE]; // data of the event being handled
+
+static modem_dispatch_stats_t stats;
+static mutex_t queue_mutex = MUTEX_INIT;
+
+#ifdef MODEM_USE_EVENT_QUEUE
+static event_queue_t* event_queue;
+static event_t dispatch_event;
+#else
+static mutex_t dispatch_mutex = MUTEX_INIT_LOCKED;
+static char dispatch_thread_stack[MODEM_DISPATCH_THREAD_STACKSIZE];
+#endif
+
+static void update_queue_depth(void) {
+  stats.queue_depth = events_count + completions_count;
+  if(stats.queue_depth > stats.max_queue_depth)
+    stats.max_queue_depth = stats.queue_depth;
+}
+
+static bool pop_event(modem_event_t* event) {
+  mutex_lock(&queue_mutex);
+  if(events_count == 0 && completions_count == 0) {
+    mutex_unlock(&queue_mutex);
+    return false;
+  }
+
+  modem_event_t* completion = &completions[completions_head];
+  if(completions_count > 0 && (events_count == 0 || (int32_t)(completion->seq - events[events_head].seq) < 0)) {
+    *event = *completion; // completions carry no data
+    completions_head = (completions_head + 1) % MODEM_DISPATCH_COMPLETION_QUEUE_SIZE;
+    completions_count--;
+  } else {
+    *event = events[events_head];
+    events_head = (events_head + 1) % MODEM_DISPATCH_QUEUE_SIZE;
+    events_count--;
+    error_t err = fifo_pop(&data_fifo, event_data, event->size); assert(err == SUCCESS);
+  }
+
+  update_queue_depth();
+  mutex_unlock(&queue_mutex);
+  return true;
+}
+
+static void dispatch_all(void) {
+  worker_pid = thread_getpid();
+  modem_event_t event;
+  while(pop_event(&event)) {
+    uint32_t latency = xtimer_now_usec() - event.queued_timestamp;
+    dispatch_handler(&event, event_data);
+
+    mutex_lock(&queue_mutex);
+    stats.dispatched++;
+    stats.total_latency_us += latency;
+    if(latency > stats.max_latency_us)
+      stats.max_latency_us = latency;
+
+    mutex_unlock(&queue_mutex);
+  }
+
+  dispatch_idle_handler();
+  worker_pid = KERNEL_PID_UNDEF;
+}
+
+bool modem_dispatch_in_worker(void) {
+  return worker_pid == thread_getpid();
+}
+
+#ifdef MODEM_USE_EVENT_QUEUE
+static void dispatch_event_handler(event_t* event) {
+  (void)event;
+  dispatch_all();
+}
+
+void modem_set_event_queue(event_queue_t* queue) {
+  event_queue = queue;
+}
+#else
+static void* dispatch_thread(void* arg) {
+  (void)arg;
+
+  while(true) {
+    // wait until events are posted
+    mutex_lock(&dispatch_mutex);
+    dispatch_all();
+  }
+
+  return NULL;
+}
+#endif
+
+void modem_dispatch_init(modem_dispatch_handler_t handler, modem_dispatch_idle_handler_t idle_handler) {
+  dispatch_handler = handler;
+  dispatch_idle_handler = idle_handler;
+  fifo_init(&data_fifo, data_buffer, sizeof(data_buffer));
+
+#ifdef MODEM_USE_EVENT_QUEUE
+  assert(event_queue != NULL); // modem_set_event_queue() should be called first
+  dispatch_event.handler = &dispatch_event_handler;
+#else
+  thread_create(dispatch_thread_stack, sizeof(dispatch_thread_stack), MODEM_DISPATCH_THREAD_PRIORITY,
+    0, dispatch_thread, NULL, "oss7_modem_dispatch");
+#endif
+}
+
+bool modem_dispatch_post(modem_event_t* event, const fifo_view_t* data) {
+  assert(event->size <= sizeof(event_data));
+
+  mutex_lock(&queue_mutex);
+  // note the data fifo can hold one byte less than its size
+  if(events_count == MODEM_DISPATCH_QUEUE_SIZE
+     || fifo_get_size(&data_fifo) + event->size >= MODEM_DISPATCH_DATA_BUFFER_SIZE - 1) {
+    stats.dropped++;
+    mutex_unlock(&queue_mutex);
+    DPRINT("!!! dispatch queue full, dropping event\n");
+    return false;
+  }
+
+  if(event->size > 0) {
+    error_t err = fifo_put(&data_fifo, data->part1, data->part1_len); assert(err == SUCCESS);
+    err = fifo_put(&data_fifo, data->part2, data->part2_len); assert(err == SUCCESS);
+  }
+
+  event->queued_timestamp = xtimer_now_usec();
+  event->seq = next_seq++;
+  events[(events_head + events_count) % MODEM_DISPATCH_QUEUE_SIZE] = *event;
+  events_count++;
+  update_queue_depth();
+  mutex_unlock(&queue_mutex);
+  modem_dispatch_wakeup();
+  return true;
+}
+
+bool modem_dispatch_reserve_completion(void) {
+  mutex_lock(&queue_mutex);
+  bool reserved = completions_count + completions_reserved < MODEM_DISPATCH_COMPLETION_QUEUE_SIZE;
+  if(reserved)
+    completions_reserved++;
+  else
+    DPRINT("!!! completion queue full\n");
+
+  mutex_unlock(&queue_mutex);
+  return reserved;
+}
+
+void modem_dispatch_cancel_completion(void) {
+  mutex_lock(&queue_mutex);
+  assert(completions_reserved > 0);
+  completions_reserved--;
+  mutex_unlock(&queue_mutex);
+}
+
+void modem_dispatch_post_completion(modem_event_t* event) {
+  assert(event->size == 0);
+  mutex_lock(&queue_mutex);
+  assert(completions_reserved > 0);
+  completions_reserved--;
+  event->queued_timestamp = xtimer_now_usec();
+  event->seq = next_seq++;
+  completions[(completions_head + completions_count) % MODEM_DISPATCH_COMPLETION_QUEUE_SIZE] = *event;
+  completions_count++;
+  update_queue_depth();
+  mutex_unlock(&queue_mutex);
+  modem_dispatch_wakeup();
+}
+
+void modem_dispatch_wakeup(void) {
+#ifdef MODEM_USE_EVENT_QUEUE
+  event_post(event_queue, &dispatch_event);
+#else
+  mutex_unlock(&dispatch_mutex);
+#endif
+}
+
+bool modem_dispatch_in_event_thread(void) {
+#ifdef MODEM_USE_EVENT_QUEUE
+  // the waiter is the thread running the event loop
+  return event_queue->waiter == (thread_t*)thread_get(thread_getpid());
+#else
+  return false; // the RX thread and worker do not depend on the caller
+#endif
+}
+
+#ifdef MODEM_USE_EVENT_QUEUE
+event_queue_t* modem_dispatch_get_event_queue(void) {
+  return event_queue;
+}
+#endif
+
+void modem_get_dispatch_stats(modem_dispatch_stats_t* dispatch_stats) {
+  mutex_lock(&queue_mutex);
+  *dispatch_stats = stats;
+  mutex_unlock(&queue_mutex);
+}
+
+void modem_reset_dispatch_stats(void) {
+  mutex_lock(&queue_mutex);
+  uint16_t queue_depth = stats.queue_depth;
+  memset(&stats, 0, sizeof(stats));
+  stats.queue_depth = queue_depth;
+  stats.max_queue_depth = queue_depth;
+  mutex_unlock(&queue_mutex);
+}
@@ -7,13 +7,20 @@
 #include "errors.h"
 #include "periph/uart.h"
 #include "mutex.h"
+#include "irq.h"
+#include "xtimer.h"
+#include "modem_dispatch.h"
 
 #include "crc.h"
 
 #include "log.h"
 
 
-#define RX_BUFFER_SIZE 256
+#define RX_BUFFER_SIZE 256 // should be a power of two, see fifo_pow2_t
+
+#if (RX_BUFFER_SIZE & (RX_BUFFER_SIZE - 1)) != 0
+#error "RX_BUFFER_SIZE should be a power of two"
+#endif
 
 #define TX_FIFO_FLUSH_CHUNK_SIZE 10 // at a baudrate of 115200 this ensures completion within 1 ms
                                     // TODO baudrate dependent
@@ -21,7 +28,7 @@
 static uart_t uart_handle;
 
 static uint8_t rx_buffer[RX_BUFFER_SIZE];
-static fifo_t rx_fifo;
+static fifo_pow2_t rx_fifo;
 
 #define DPRINT(...) printf(__VA_ARGS__)
 #define DPRINT_DATA(...) // log_print_data(__VA_ARGS__)
@@ -36,10 +43,11 @@ static fifo_t rx_fifo;
 #define SERIAL_FRAME_CRC1   5
 #define SERIAL_FRAME_CRC2   6
 
-#define MODEM_INTERFACE_TX_FIFO_SIZE 255
-static uint8_t modem_interface_tx_buffer[MODEM_INTERFACE_TX_FIFO_SIZE];
-static fifo_t modem_interface_tx_fifo;
-static bool request_pending = false;
+#ifndef MODEM_INTERFACE_RX_THREAD_STACKSIZE
+#define MODEM_INTERFACE_RX_THREAD_STACKSIZE THREAD_STACKSIZE_MAIN // the actions are parsed one by one without copying, see alp_parser_next()
+#endif
+
+static mutex_t tx_mutex = MUTEX_INIT;
 
 uint8_t header[SERIAL_FRAME_HEADER_SIZE];
 static uint8_t payload_len = 0;
@@ -50,14 +58,21 @@ static uint32_t target_uart_state_pin;
 
 static bool modem_listen_uart_inited = false;
 static bool parsed_header = false;
+static volatile uint32_t rx_burst_timestamp; // first byte received after the RX fifo was empty
+static volatile bool rx_burst_consumed = false; // a frame of the current burst was processed already
+static volatile bool rx_reset_requested = false; // set by modem_interface_reset(), handled by the RX context
+static uint32_t rx_frame_timestamp;
 
 cmd_handler_t alp_handler;
 cmd_handler_t ping_response_handler;
 cmd_handler_t logging_handler;
 
+#ifdef MODEM_USE_EVENT_QUEUE
+static event_t rx_event; // the received data is processed from the user's event queue, instead of a dedicated thread
+#else
 static mutex_t rx_mutex = MUTEX_INIT_LOCKED;
-// static uint8_t rx_buffer[RX_BUFFER_SIZE];
-static char rx_thread_stack[THREAD_STACKSIZE_MAIN];
+static char rx_thread_stack[MODEM_INTERFACE_RX_THREAD_STACKSIZE];
+#endif
 
 
 typedef enum {
@@ -78,6 +93,16 @@ static state_t state = STATE_IDLE;
 
 static void process_rx_fifo(void);
 
+// makes sure process_rx_fifo() is executed (again), can be called from interrupt context
+static void schedule_rx_processing(void)
+{
+#ifdef MODEM_USE_EVENT_QUEUE
+  event_post(modem_dispatch_get_event_queue(), &rx_event); // no-op when already queued
+#else
+  mutex_unlock(&rx_mutex);
+#endif
+}
+
 
 /** @Brief Enable UART interface and UART interrupt
  *  @return void
@@ -113,19 +138,6 @@ static void modem_interface_enable(void)
 // #endif
 // }
 
-/** @brief transmit data in fifo to UART
- *  @return void
- */
-static void flush_modem_interface_tx_fifo(void *arg)
-{
-  (void)arg; // suppress unuesed warning
-  uint8_t len = fifo_get_size(&modem_interface_tx_fifo);
-  uint8_t buffer[MODEM_INTERFACE_TX_FIFO_SIZE];
-  fifo_pop(&modem_interface_tx_fifo, buffer, len);
-  uart_write(uart_handle, buffer, len);
-  DPRINT("flush %i\n", len);
-}
-
 /** @Brief Keeps µC awake while receiving UART data
  *  @return void
  */
@@ -258,40 +270,54 @@ static bool verify_payload(fifo_t* bytes, uint8_t* header)
  */
 static void process_rx_fifo(void)
 {
+  if(rx_reset_requested) {
+    rx_reset_requested = false;
+    unsigned irq_state = irq_disable(); // the ISR moves the tail
+    fifo_pow2_clear(&rx_fifo);
+    irq_restore(irq_state);
+    parsed_header = false;
+    payload_len = 0;
+    packet_down_counter = 0;
+    return;
+  }
+
   if(!parsed_header)
   {
-    if(fifo_get_size(&rx_fifo) > SERIAL_FRAME_HEADER_SIZE)
+    if(fifo_pow2_get_size(&rx_fifo) > SERIAL_FRAME_HEADER_SIZE)
     {
-        fifo_peek(&rx_fifo, header, 0, SERIAL_FRAME_HEADER_SIZE);
+        fifo_pow2_peek(&rx_fifo, header, 0, SERIAL_FRAME_HEADER_SIZE);
 
         if(header[0] != SERIAL_FRAME_SYNC_BYTE || header[1] != SERIAL_FRAME_VERSION)
         {
-          fifo_skip(&rx_fifo, 1);
+          fifo_pow2_skip(&rx_fifo, 1);
           DPRINT("skip\n");
           parsed_header = false;
           payload_len = 0;
-          if(fifo_get_size(&rx_fifo) > SERIAL_FRAME_HEADER_SIZE)
-            mutex_lock(&rx_mutex); // wait for more data
+          if(fifo_pow2_get_size(&rx_fifo) > SERIAL_FRAME_HEADER_SIZE)
+            schedule_rx_processing(); // continue searching for the sync bytes
 
           return;
         }
         parsed_header = true;
-        fifo_skip(&rx_fifo, SERIAL_FRAME_HEADER_SIZE);
+        // for back-to-back frames the first byte is not timestamped, the time the header is parsed is used instead
+        rx_frame_timestamp = rx_burst_consumed ? xtimer_now_usec() : rx_burst_timestamp;
+        rx_burst_consumed = true;
+        fifo_pow2_skip(&rx_fifo, SERIAL_FRAME_HEADER_SIZE);
         payload_len = header[SERIAL_FRAME_SIZE];
         DPRINT("UART RX, payload size = %i\n", payload_len);
-        mutex_unlock(&rx_mutex); // implicit return, task will re-run to parse payload
+        schedule_rx_processing(); // implicit return, task will re-run to parse payload
     }
   }
   else
   {
-    if(fifo_get_size(&rx_fifo) < payload_len) {
+    if(fifo_pow2_get_size(&rx_fifo) < payload_len) {
       return;
     }
     // payload complete, start parsing
     // rx_fifo can be bigger than the current serial packet, init a subview fifo
     // which is restricted to payload_len so we can't parse past this packet.
     fifo_t payload_fifo;
-    fifo_init_subview(&payload_fifo, &rx_fifo, 0, payload_len);
+    fifo_pow2_init_subview(&payload_fifo, &rx_fifo, 0, payload_len);
 
     if(verify_payload(&payload_fifo,(uint8_t *)&header))
     {
@@ -312,7 +338,7 @@ static void process_rx_fifo(void)
         fifo_skip(&payload_fifo, payload_len);
         DPRINT("!!!FRAME TYPE NOT IMPLEMENTED: %i\n", header[SERIAL_FRAME_TYPE]);
       }
-      fifo_skip(&rx_fifo, payload_len - fifo_get_size(&payload_fifo)); // pop parsed bytes from original fifo
+      fifo_pow2_skip(&rx_fifo, payload_len - fifo_get_size(&payload_fifo)); // pop parsed bytes from original fifo
     }
     else
     {
@@ -321,8 +347,8 @@ static void process_rx_fifo(void)
 
     payload_len = 0;
     parsed_header = false;
-    if(fifo_get_size(&rx_fifo) > SERIAL_FRAME_HEADER_SIZE)
-      mutex_unlock(&rx_mutex); // implicit return, task will re-run
+    if(fifo_pow2_get_size(&rx_fifo) > SERIAL_FRAME_HEADER_SIZE)
+      schedule_rx_processing(); // implicit return, task will re-run
   }
 }
 /** @Brief put received UART data in fifo
@@ -331,10 +357,15 @@ static void process_rx_fifo(void)
 static void uart_rx_cb(void * arg, uint8_t data)
 {
     (void)arg; // suppress warning
-    assert(fifo_put(&rx_fifo, &data, 1) == 0);
+    if(fifo_pow2_get_size(&rx_fifo) == 0) {
+      rx_burst_timestamp = xtimer_now_usec();
+      rx_burst_consumed = false;
+    }
+
+    error_t err = fifo_pow2_put_byte(&rx_fifo, data); assert(err == SUCCESS);
 
 #ifndef PLATFORM_USE_MODEM_INTERRUPT_LINES
-    mutex_unlock(&rx_mutex); // start processing thread
+    schedule_rx_processing();
 #endif
 }
 
@@ -355,6 +386,13 @@ static void uart_rx_cb(void * arg, uint8_t data)
 // #endif
 // }
 
+#ifdef MODEM_USE_EVENT_QUEUE
+static void rx_event_handler(event_t* event)
+{
+  (void)event;
+  process_rx_fifo();
+}
+#else
 void* rx_thread(void* arg) {
 	(void) arg; // supress warning
 
@@ -368,11 +406,11 @@ void* rx_thread(void* arg) {
 
 	return NULL;
 }
+#endif
 
 
 void modem_interface_init(uint8_t idx, uint32_t baudrate, uint32_t uart_state_int_pin, uint32_t target_uart_state_int_pin) // TODO pins
 {
-  fifo_init(&modem_interface_tx_fifo, modem_interface_tx_buffer, MODEM_INTERFACE_TX_FIFO_SIZE);
   // sched_register_task(&flush_modem_interface_tx_fifo);
   // sched_register_task(&execute_state_machine);
   // sched_register_task(&process_rx_fifo);
@@ -380,14 +418,18 @@ void modem_interface_init(uint8_t idx, uint32_t baudrate, uint32_t uart_state_in
   uart_state_pin = uart_state_int_pin;
   target_uart_state_pin = target_uart_state_int_pin;
 
+#ifdef MODEM_USE_EVENT_QUEUE
+  rx_event.handler = &rx_event_handler;
+#else
   thread_create(rx_thread_stack, sizeof(rx_thread_stack), THREAD_PRIORITY_MAIN -1,
 	 	0 , rx_thread , NULL, "oss7_modem_rx");
+#endif
 
 
   uart_handle = UART_DEV(idx);
   uart_init(uart_handle, baudrate, &uart_rx_cb, NULL);
 
-  fifo_init(&rx_fifo, rx_buffer, sizeof(rx_buffer));
+  fifo_pow2_init(&rx_fifo, rx_buffer, sizeof(rx_buffer));
   //modem_interface_set_rx_interrupt_callback(&uart_rx_cb);
 
 #ifdef PLATFORM_USE_MODEM_INTERRUPT_LINES
@@ -411,31 +453,52 @@ void modem_interface_init(uint8_t idx, uint32_t baudrate, uint32_t uart_state_in
 
 void modem_interface_transfer_bytes(uint8_t* bytes, uint8_t length, serial_message_type_t type)
 {
+  modem_interface_transfer_parts(bytes, length, NULL, 0, type);
+}
+
+void modem_interface_transfer_parts(uint8_t* part1, uint8_t part1_length, uint8_t* part2, uint8_t part2_length, serial_message_type_t type)
+{
+  modem_interface_transfer_parts_timed(part1, part1_length, part2, part2_length, type, NULL, NULL);
+}
+
+void modem_interface_transfer_parts_timed(uint8_t* part1, uint8_t part1_length, uint8_t* part2, uint8_t part2_length,
+                                          serial_message_type_t type, uint32_t* tx_start, uint32_t* tx_end)
+{
+  assert(part1_length + part2_length <= UINT8_MAX);
   uint8_t header[SERIAL_FRAME_HEADER_SIZE];
-  uint16_t crc=crc_calculate(bytes,length);
+  uint16_t crc = crc_calculate(part1, part1_length);
+  crc = crc_update(crc, part2, part2_length);
 
+  mutex_lock(&tx_mutex);
   packet_up_counter++;
   header[0] = SERIAL_FRAME_SYNC_BYTE;
   header[1] = SERIAL_FRAME_VERSION;
 
   header[SERIAL_FRAME_COUNTER] = packet_up_counter;
   header[SERIAL_FRAME_TYPE] = type;
-  header[SERIAL_FRAME_SIZE] = length;
+  header[SERIAL_FRAME_SIZE] = part1_length + part2_length;
   header[SERIAL_FRAME_CRC1] = (crc >> 8) & 0x00FF;
   header[SERIAL_FRAME_CRC2] = crc & 0x00FF;
 
   DPRINT("TX HEADER:\n");
   DPRINT_DATA(header, SERIAL_FRAME_HEADER_SIZE);
-  DPRINT("TX PAYLOAD: %i bytes\n", length);
-  DPRINT_DATA(bytes, length);
+  DPRINT("TX PAYLOAD: %i bytes\n", part1_length + part2_length);
+  DPRINT_DATA(part1, part1_length);
+  DPRINT_DATA(part2, part2_length);
+
+  // the frame is written to the UART directly, without copying it in a TX fifo first
+  if(tx_start)
+    *tx_start = xtimer_now_usec();
+
+  uart_write(uart_handle, header, SERIAL_FRAME_HEADER_SIZE);
+  uart_write(uart_handle, part1, part1_length);
+  if(part2_length > 0)
+    uart_write(uart_handle, part2, part2_length);
 
-  // start_atomic();
-  request_pending = true;
-  fifo_put(&modem_interface_tx_fifo, (uint8_t*) &header, SERIAL_FRAME_HEADER_SIZE);
-  fifo_put(&modem_interface_tx_fifo, bytes, length);
-  // end_atomic();
+  if(tx_end)
+    *tx_end = xtimer_now_usec(); // uart_write() returns when the last byte is transmitted
 
-  flush_modem_interface_tx_fifo(NULL);
+  mutex_unlock(&tx_mutex);
 // #ifdef PLATFORM_USE_MODEM_INTERRUPT_LINES
 //   sched_post_task_prio(&execute_state_machine, MIN_PRIORITY, NULL);
 // #else
@@ -443,6 +506,22 @@ void modem_interface_transfer_bytes(uint8_t* bytes, uint8_t length, serial_messa
 // #endif
 }
 
+uint32_t modem_interface_get_rx_frame_timestamp(void)
+{
+  return rx_frame_timestamp;
+}
+
+void modem_interface_reset(void)
+{
+  mutex_lock(&tx_mutex);
+  packet_up_counter = 0;
+  mutex_unlock(&tx_mutex);
+  // the RX state is reset by the context parsing the frames, which might be using it now
+  rx_reset_requested = true;
+  schedule_rx_processing();
+  DPRINT("modem interface reset\n");
+}
+
 void modem_interface_transfer(char* string) {
   modem_interface_transfer_bytes((uint8_t*) string, strlen(string), SERIAL_MESSAGE_TYPE_LOGGING);
 }
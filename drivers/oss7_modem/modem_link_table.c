@@ -0,0 +1,119 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2018 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include "modem.h"
+#include "modem_link_table.h"
+#include "debug.h"
+#include "mutex.h"
+#include "xtimer.h"
+
+#define AVG_WEIGHT 8 // rolling averages weigh a new sample with 1/AVG_WEIGHT
+
+static modem_link_status_t table[MODEM_LINK_TABLE_SIZE];
+static uint8_t table_count = 0;
+static mutex_t table_mutex = MUTEX_INIT;
+
+static uint8_t rolling_avg(uint8_t avg, uint8_t sample) {
+  return (uint8_t)(((uint16_t)avg * (AVG_WEIGHT - 1) + sample + AVG_WEIGHT / 2) / AVG_WEIGHT);
+}
+
+static modem_link_status_t* find(const uint8_t* uid) {
+  for(uint8_t i = 0; i < table_count; i++) {
+    if(memcmp(table[i].uid, uid, D7A_FILE_UID_SIZE) == 0)
+      return &table[i];
+  }
+
+  return NULL;
+}
+
+// returns the existing entry for uid, or a new one (replacing the least recently seen peer when the table is full).
+// Only called for received responses, so the LRU order reflects when peers answered.
+static modem_link_status_t* find_or_add(const uint8_t* uid) {
+  modem_link_status_t* entry = find(uid);
+  if(entry)
+    return entry;
+
+  if(table_count < MODEM_LINK_TABLE_SIZE) {
+    entry = &table[table_count];
+    table_count++;
+  } else {
+    entry = &table[0];
+    for(uint8_t i = 1; i < table_count; i++) {
+      if(table[i].last_seen < entry->last_seen)
+        entry = &table[i];
+    }
+  }
+
+  memset(entry, 0, sizeof(modem_link_status_t));
+  memcpy(entry->uid, uid, D7A_FILE_UID_SIZE);
+  return entry;
+}
+
+void modem_link_table_update(const d7ap_session_result_t* result) {
+  if(result->addressee.ctrl.id_type != ID_TYPE_UID)
+    return;
+
+  mutex_lock(&table_mutex);
+  modem_link_status_t* entry = find_or_add(result->addressee.id);
+  if(entry->requests == 0)
+    entry->requests = 1; // the request to a peer which was not in the table yet was not counted
+
+  if(entry->responses == 0) {
+    entry->avg_rx_level = result->rx_level;
+    entry->avg_link_budget = result->link_budget;
+  } else {
+    entry->avg_rx_level = rolling_avg(entry->avg_rx_level, result->rx_level);
+    entry->avg_link_budget = rolling_avg(entry->avg_link_budget, result->link_budget);
+  }
+
+  entry->rx_level = result->rx_level;
+  entry->link_budget = result->link_budget;
+  entry->last_seen = xtimer_now_usec64() / US_PER_SEC;
+  entry->responses++;
+  mutex_unlock(&table_mutex);
+}
+
+void modem_link_table_add_request(const uint8_t* uid) {
+  mutex_lock(&table_mutex);
+  // requests do not create entries, unresponsive peers would evict the peers which answered
+  modem_link_status_t* entry = find(uid);
+  if(entry)
+    entry->requests++;
+
+  mutex_unlock(&table_mutex);
+}
+
+bool modem_get_link_status(const uint8_t* uid, modem_link_status_t* status) {
+  mutex_lock(&table_mutex);
+  modem_link_status_t* entry = find(uid);
+  if(entry)
+    *status = *entry;
+
+  mutex_unlock(&table_mutex);
+  return entry != NULL;
+}
+
+uint8_t modem_get_link_table(modem_link_status_t* entries, uint8_t max_entries) {
+  mutex_lock(&table_mutex);
+  uint8_t count = table_count < max_entries ? table_count : max_entries;
+  memcpy(entries, table, count * sizeof(modem_link_status_t));
+  mutex_unlock(&table_mutex);
+  return count;
+}
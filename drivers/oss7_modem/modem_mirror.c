@@ -0,0 +1,150 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2018 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include "modem.h"
+#include "debug.h"
+
+static void remove_ranges(modem_mirror_t* mirror, uint8_t index, uint8_t count) {
+  memmove(&mirror->dirty[index], &mirror->dirty[index + count],
+          (mirror->range_count - index - count) * sizeof(modem_mirror_range_t));
+  mirror->range_count -= count;
+}
+
+// merges range index + 1 into range index
+static void merge_next(modem_mirror_t* mirror, uint8_t index) {
+  if(mirror->dirty[index + 1].end > mirror->dirty[index].end)
+    mirror->dirty[index].end = mirror->dirty[index + 1].end;
+
+  remove_ranges(mirror, index + 1, 1);
+}
+
+static void add_range(modem_mirror_t* mirror, uint16_t start, uint16_t end) {
+  // keep the ranges sorted on start, there is room for one extra range
+  uint8_t i = 0;
+  while(i < mirror->range_count && mirror->dirty[i].start < start)
+    i++;
+
+  memmove(&mirror->dirty[i + 1], &mirror->dirty[i], (mirror->range_count - i) * sizeof(modem_mirror_range_t));
+  mirror->dirty[i].start = start;
+  mirror->dirty[i].end = end;
+  mirror->range_count++;
+
+  // merge overlapping ranges and ranges close to each other, since every write action has a few bytes overhead
+  i = 0;
+  while(i + 1 < mirror->range_count) {
+    if(mirror->dirty[i + 1].start <= mirror->dirty[i].end + MODEM_MIRROR_MERGE_GAP)
+      merge_next(mirror, i);
+    else
+      i++;
+  }
+
+  if(mirror->range_count > MODEM_MIRROR_MAX_RANGES) {
+    // no more room, merge the ranges with the smallest gap in between
+    uint8_t closest = 0;
+    for(i = 1; i + 1 < mirror->range_count; i++) {
+      if(mirror->dirty[i + 1].start - mirror->dirty[i].end < mirror->dirty[closest + 1].start - mirror->dirty[closest].end)
+        closest = i;
+    }
+
+    merge_next(mirror, closest);
+  }
+}
+
+void modem_mirror_init(modem_mirror_t* mirror, uint8_t file_id, uint8_t* buffer, uint16_t size) {
+  mirror->file_id = file_id;
+  mirror->buffer = buffer;
+  mirror->size = size;
+  mirror->range_count = 0;
+}
+
+void modem_mirror_mark_dirty(modem_mirror_t* mirror, uint16_t offset, uint16_t length) {
+  assert(offset + length <= mirror->size);
+  if(length == 0)
+    return;
+
+  add_range(mirror, offset, offset + length);
+}
+
+void modem_mirror_mark_all_dirty(modem_mirror_t* mirror) {
+  mirror->range_count = 0;
+  modem_mirror_mark_dirty(mirror, 0, mirror->size);
+}
+
+void modem_mirror_write(modem_mirror_t* mirror, uint16_t offset, const uint8_t* data, uint16_t length) {
+  assert(offset + length <= mirror->size);
+  uint8_t* buffer = mirror->buffer + offset;
+
+  // only the bytes which actually changed are marked dirty
+  uint16_t first = 0;
+  while(first < length && buffer[first] == data[first])
+    first++;
+
+  if(first == length)
+    return;
+
+  uint16_t last = length - 1;
+  while(buffer[last] == data[last])
+    last--;
+
+  memcpy(buffer + first, data + first, last - first + 1);
+  add_range(mirror, offset + first, offset + last + 1);
+}
+
+bool modem_mirror_is_dirty(modem_mirror_t* mirror) {
+  return mirror->range_count > 0;
+}
+
+modem_status_t modem_mirror_sync(modem_mirror_t* mirror) {
+  while(mirror->range_count > 0) {
+    if(!modem_batch_start(NULL))
+      return MODEM_STATUS_BUSY;
+
+    // append as many ranges as fit in one command, a range larger than MODEM_MIRROR_MAX_WRITE_SIZE is split
+    uint8_t appended = 0;
+    uint16_t partial_end = 0;
+    while(appended < mirror->range_count) {
+      modem_mirror_range_t* range = &mirror->dirty[appended];
+      uint16_t length = range->end - range->start;
+      if(length > MODEM_MIRROR_MAX_WRITE_SIZE)
+        length = MODEM_MIRROR_MAX_WRITE_SIZE;
+
+      if(!modem_batch_append_write(mirror->file_id, range->start, length, mirror->buffer + range->start))
+        break;
+
+      if(range->start + length < range->end) {
+        partial_end = range->start + length;
+        break;
+      }
+
+      appended++;
+    }
+
+    assert(appended > 0 || partial_end > 0);
+    modem_status_t status = modem_batch_send();
+    if(status != MODEM_STATUS_COMMAND_COMPLETED_SUCCESS)
+      return status; // the ranges stay dirty
+
+    remove_ranges(mirror, 0, appended);
+    if(partial_end)
+      mirror->dirty[0].start = partial_end;
+  }
+
+  return MODEM_STATUS_COMMAND_COMPLETED_SUCCESS;
+}
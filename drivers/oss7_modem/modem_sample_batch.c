@@ -0,0 +1,146 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2018 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stdio.h>
+
+#include "modem.h"
+#include "modem_dispatch.h"
+#include "modem_sample_batch.h"
+#include "debug.h"
+#include "mutex.h"
+#include "xtimer.h"
+
+#define DPRINT(...) printf(__VA_ARGS__)
+
+#if MODEM_SAMPLE_BATCH_MAX_SIZE > MODEM_UPLINK_MAX_DATA_SIZE
+#error "MODEM_SAMPLE_BATCH_MAX_SIZE should not exceed MODEM_UPLINK_MAX_DATA_SIZE"
+#endif
+
+#if MODEM_SAMPLE_BATCH_MAX_SIZE < SAMPLE_CODEC_HEADER_MAX_SIZE + SAMPLE_CODEC_VARINT_MAX_SIZE
+#error "MODEM_SAMPLE_BATCH_MAX_SIZE too small to contain a sample"
+#endif
+
+static modem_sample_batch_t* batches = NULL; // all initialized batches
+static mutex_t batches_mutex = MUTEX_INIT;
+
+static void start_frame(modem_sample_batch_t* batch) {
+  batch->header.count = 0;
+  batch->length = batch->header_length; // the header is written when flushing, when the count is known
+  batch->last_sample = 0;
+}
+
+static void age_timeout(void* arg) {
+  modem_sample_batch_t* batch = arg;
+  batch->expired = true;
+  modem_dispatch_wakeup(); // interrupt safe, the frame is flushed by the worker
+}
+
+void modem_sample_batch_init(modem_sample_batch_t* batch, uint8_t file_id, modem_sample_batch_flush_t flush,
+                             uint8_t max_samples, uint32_t max_age_ms, uint32_t interval_s) {
+  assert(max_samples > 0);
+  batch->file_id = file_id;
+  batch->flush = flush;
+  batch->priority = MODEM_PRIORITY_DEFAULT;
+  batch->max_samples = max_samples;
+  batch->max_age_ms = max_age_ms;
+  batch->header.version = SAMPLE_CODEC_VERSION;
+  batch->header.seqnr = 0;
+  batch->header.interval_s = interval_s;
+  batch->header_length = 3 + sample_codec_encode_varint(NULL, interval_s);
+  batch->expired = false;
+  batch->age_timer.callback = &age_timeout;
+  batch->age_timer.arg = batch;
+  mutex_init(&batch->mutex);
+  start_frame(batch);
+
+  mutex_lock(&batches_mutex);
+  modem_sample_batch_t** pos = &batches;
+  while(*pos && *pos != batch)
+    pos = &(*pos)->next;
+
+  if(*pos == NULL) {
+    batch->next = NULL;
+    *pos = batch;
+  }
+
+  mutex_unlock(&batches_mutex);
+}
+
+// should be called with the mutex of the batch locked
+static bool flush(modem_sample_batch_t* batch) {
+  xtimer_remove(&batch->age_timer);
+  batch->expired = false;
+  if(batch->header.count == 0)
+    return true;
+
+  sample_codec_encode_header(batch->frame, &batch->header);
+  DPRINT("flushing %i samples in %i bytes\n", batch->header.count, batch->length);
+  bool queued;
+  if(batch->flush)
+    queued = batch->flush(batch->file_id, batch->frame, batch->length);
+  else
+    queued = modem_uplink_push_prio(batch->file_id, 0, batch->length, batch->frame, batch->priority); // the data is copied
+
+  batch->header.seqnr++;
+  start_frame(batch);
+  return queued;
+}
+
+bool modem_sample_batch_flush(modem_sample_batch_t* batch) {
+  mutex_lock(&batch->mutex);
+  bool queued = flush(batch);
+  mutex_unlock(&batch->mutex);
+  return queued;
+}
+
+bool modem_sample_batch_add(modem_sample_batch_t* batch, int32_t sample) {
+  mutex_lock(&batch->mutex);
+  bool queued = true;
+  if(batch->length + sample_codec_encode_sample(NULL, batch->last_sample, sample) > MODEM_SAMPLE_BATCH_MAX_SIZE)
+    queued = flush(batch); // the first sample of a new frame always fits
+
+  if(batch->header.count == 0 && batch->max_age_ms > 0)
+    xtimer_set(&batch->age_timer, batch->max_age_ms * US_PER_MS);
+
+  batch->length += sample_codec_encode_sample(batch->frame + batch->length, batch->last_sample, sample);
+  batch->last_sample = sample;
+  batch->header.count++;
+
+  if(batch->header.count == batch->max_samples || batch->max_age_ms == 0)
+    queued = flush(batch) && queued;
+
+  mutex_unlock(&batch->mutex);
+  return queued;
+}
+
+void modem_sample_batch_run(void) {
+  mutex_lock(&batches_mutex);
+  for(modem_sample_batch_t* batch = batches; batch; batch = batch->next) {
+    if(!batch->expired)
+      continue;
+
+    mutex_lock(&batch->mutex);
+    if(batch->expired) // not flushed in the meantime
+      flush(batch);
+
+    mutex_unlock(&batch->mutex);
+  }
+
+  mutex_unlock(&batches_mutex);
+}
@@ -0,0 +1,212 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2018 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <string.h>
+
+#include "modem.h"
+#include "modem_scheduler.h"
+#include "debug.h"
+#include "errors.h"
+#include "mutex.h"
+#include "xtimer.h"
+
+#define D7_FRAME_OVERHEAD 18 // length, subnet, control, CRC and the D7ANP and D7ATP headers, without the addressee ID
+#define D7_PREAMBLE_SYNC_LENGTH 6 // preamble and sync word in bytes (hi-rate uses a longer preamble, ignored)
+#define LORAWAN_FRAME_OVERHEAD 13 // MHDR, FHDR, FPort and MIC
+#define LORA_PREAMBLE_SYMBOLS 8
+
+typedef struct {
+  bool in_use;
+  alp_itf_id_t itf_id;
+  uint8_t access_class; // D7 only
+  uint32_t bitrate; // D7 only, in bps, halved for FEC
+  uint8_t spreading_factor; // LoRaWAN only
+  uint16_t duty_permil;
+  int64_t tokens_us; // airtime credit, negative while in debt
+  int64_t burst_us; // max credit
+  uint64_t last_refill_us;
+} bucket_t;
+
+static bucket_t buckets[MODEM_SCHEDULER_BUCKETS];
+static mutex_t scheduler_mutex = MUTEX_INIT;
+
+static void refill(bucket_t* bucket) {
+  uint64_t now = xtimer_now_usec64();
+  bucket->tokens_us += (int64_t)((now - bucket->last_refill_us) * bucket->duty_permil / 1000);
+  if(bucket->tokens_us > bucket->burst_us)
+    bucket->tokens_us = bucket->burst_us;
+
+  bucket->last_refill_us = now;
+}
+
+static bucket_t* add_bucket(alp_itf_id_t itf_id, uint8_t access_class, uint16_t duty_permil, uint32_t burst_ms) {
+  bucket_t* bucket = NULL;
+  for(uint8_t i = 0; i < MODEM_SCHEDULER_BUCKETS; i++) {
+    if(buckets[i].in_use && buckets[i].itf_id == itf_id && buckets[i].access_class == access_class) {
+      bucket = &buckets[i]; // reconfigure
+      break;
+    }
+
+    if(!buckets[i].in_use && bucket == NULL)
+      bucket = &buckets[i];
+  }
+
+  if(bucket == NULL)
+    return NULL;
+
+  memset(bucket, 0, sizeof(bucket_t));
+  bucket->in_use = true;
+  bucket->itf_id = itf_id;
+  bucket->access_class = access_class;
+  bucket->duty_permil = duty_permil;
+  bucket->burst_us = (int64_t)burst_ms * US_PER_MS;
+  bucket->tokens_us = bucket->burst_us;
+  bucket->last_refill_us = xtimer_now_usec64();
+  return bucket;
+}
+
+error_t modem_scheduler_add_d7_access_profile(uint8_t access_class, const dae_access_profile_t* profile, uint32_t burst_ms) {
+  // the modem might use any subband of the profile, so the strictest duty cycle applies
+  uint16_t duty_permil = 0;
+  for(uint8_t i = 0; i < SUBPROFILES_NB; i++) {
+    for(uint8_t j = 0; j < SUBBANDS_NB; j++) {
+      uint8_t duty = profile->subbands[j].duty;
+      if((profile->subprofiles[i].subband_bitmap & (1 << j)) && duty > 0 && (duty_permil == 0 || duty < duty_permil))
+        duty_permil = duty;
+    }
+  }
+
+  if(duty_permil == 0)
+    return SUCCESS; // not limited
+
+  uint32_t bitrate;
+  switch(profile->channel_header.ch_class) {
+    case 0:
+      bitrate = 9600; // lo-rate
+      break;
+    case 3:
+      bitrate = 166667; // hi-rate
+      break;
+    default:
+      bitrate = 55555; // normal rate
+  }
+
+  if(profile->channel_header.ch_coding == 2)
+    bitrate /= 2; // FEC
+
+  mutex_lock(&scheduler_mutex);
+  bucket_t* bucket = add_bucket(ALP_ITF_ID_D7ASP, access_class, duty_permil, burst_ms);
+  if(bucket)
+    bucket->bitrate = bitrate;
+
+  mutex_unlock(&scheduler_mutex);
+  return bucket ? SUCCESS : ESIZE;
+}
+
+error_t modem_scheduler_add_lorawan(uint8_t spreading_factor, uint16_t duty_permil, uint32_t burst_ms) {
+  assert(spreading_factor >= 7 && spreading_factor <= 12);
+  if(duty_permil == 0)
+    return EINVAL; // the delay is calculated from the refill rate
+
+  mutex_lock(&scheduler_mutex);
+  // OTAA and ABP use the same radio, so they share a bucket
+  bucket_t* bucket = add_bucket(ALP_ITF_ID_LORAWAN_OTAA, 0, duty_permil, burst_ms);
+  if(bucket)
+    bucket->spreading_factor = spreading_factor;
+
+  mutex_unlock(&scheduler_mutex);
+  return bucket ? SUCCESS : ESIZE;
+}
+
+uint8_t modem_scheduler_get_bucket(session_config_t* session_config) {
+  alp_itf_id_t itf_id;
+  uint8_t access_class = 0;
+  switch(session_config->interface_type) {
+    case DASH7:
+      itf_id = ALP_ITF_ID_D7ASP;
+      access_class = session_config->d7ap_session_config.addressee.access_class;
+      break;
+    case LORAWAN_OTAA:
+    case lorawan_ABP:
+      itf_id = ALP_ITF_ID_LORAWAN_OTAA;
+      break;
+    default:
+      return MODEM_SCHEDULER_NO_BUCKET; // the interface in an interface file is not known on the host
+  }
+
+  for(uint8_t i = 0; i < MODEM_SCHEDULER_BUCKETS; i++) {
+    if(buckets[i].in_use && buckets[i].itf_id == itf_id && buckets[i].access_class == access_class)
+      return i;
+  }
+
+  return MODEM_SCHEDULER_NO_BUCKET;
+}
+
+// LoRa time on air for 125 kHz bandwidth, coding rate 4/5, explicit header and CRC enabled
+static uint32_t lora_airtime_us(uint8_t spreading_factor, uint8_t payload_length) {
+  uint32_t symbol_us = (1 << spreading_factor) * 8; // 2^SF / 125 kHz
+  bool low_datarate_optimize = spreading_factor >= 11;
+  int32_t num = 8 * (payload_length + LORAWAN_FRAME_OVERHEAD) - 4 * spreading_factor + 28 + 16;
+  int32_t den = 4 * (spreading_factor - 2 * low_datarate_optimize);
+  uint32_t payload_symbols = 8;
+  if(num > 0)
+    payload_symbols += ((num + den - 1) / den) * 5;
+
+  // preamble takes 4.25 symbols more than the number of preamble symbols
+  return ((4 * (LORA_PREAMBLE_SYMBOLS + payload_symbols) + 17) * symbol_us) / 4;
+}
+
+uint32_t modem_scheduler_estimate_airtime_us(uint8_t bucket_index, session_config_t* session_config, uint8_t payload_length) {
+  bucket_t* bucket = &buckets[bucket_index];
+  if(bucket->itf_id != ALP_ITF_ID_D7ASP)
+    return lora_airtime_us(bucket->spreading_factor, payload_length);
+
+  uint8_t id_length = d7ap_addressee_id_length(session_config->d7ap_session_config.addressee.ctrl.id_type);
+  uint32_t frame_bits = 8 * (D7_PREAMBLE_SYNC_LENGTH + D7_FRAME_OVERHEAD + id_length + payload_length);
+  return (uint32_t)((uint64_t)frame_bits * US_PER_SEC / bucket->bitrate);
+}
+
+uint32_t modem_scheduler_get_delay_us(uint8_t bucket_index) {
+  if(bucket_index == MODEM_SCHEDULER_NO_BUCKET)
+    return 0;
+
+  mutex_lock(&scheduler_mutex);
+  bucket_t* bucket = &buckets[bucket_index];
+  refill(bucket);
+  uint32_t delay = 0;
+  if(bucket->tokens_us < 0)
+    delay = (uint32_t)(-bucket->tokens_us * 1000 / bucket->duty_permil); // time until the debt is paid off
+
+  mutex_unlock(&scheduler_mutex);
+  return delay;
+}
+
+void modem_scheduler_consume(uint8_t bucket_index, uint32_t airtime_us) {
+  if(bucket_index == MODEM_SCHEDULER_NO_BUCKET)
+    return;
+
+  mutex_lock(&scheduler_mutex);
+  refill(&buckets[bucket_index]);
+  buckets[bucket_index].tokens_us -= airtime_us;
+  mutex_unlock(&scheduler_mutex);
+}
+
+uint32_t modem_scheduler_get_delay_ms(session_config_t* session_config) {
+  return modem_scheduler_get_delay_us(modem_scheduler_get_bucket(session_config)) / US_PER_MS;
+}
@@ -0,0 +1,225 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2018 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include "modem.h"
+#include "modem_trace.h"
+#include "debug.h"
+#include "mutex.h"
+#include "xtimer.h"
+
+#ifdef MODEM_TRACE
+
+static modem_trace_record_t ring[MODEM_TRACE_SIZE];
+static uint8_t head = 0;
+static uint8_t count = 0;
+static uint16_t histograms[MODEM_TRACE_ITF_COUNT][MODEM_TRACE_PHASE_COUNT][MODEM_TRACE_HISTOGRAM_BUCKETS];
+static mutex_t trace_mutex = MUTEX_INIT;
+
+static const char* phase_names[MODEM_TRACE_PHASE_COUNT] = { "queue", "uart tx", "modem", "uart rx", "delivery", "total" };
+static const char* itf_names[MODEM_TRACE_ITF_COUNT] = { "local", "d7", "lorawan", "file" };
+
+// start and end timestamp of every phase
+static const uint8_t phase_bounds[MODEM_TRACE_PHASE_COUNT][2] = {
+  { MODEM_TRACE_SUBMIT, MODEM_TRACE_TX_START },
+  { MODEM_TRACE_TX_START, MODEM_TRACE_TX_END },
+  { MODEM_TRACE_TX_END, MODEM_TRACE_RX_START },
+  { MODEM_TRACE_RX_START, MODEM_TRACE_TAG_PARSED },
+  { MODEM_TRACE_TAG_PARSED, MODEM_TRACE_DELIVERED },
+  { MODEM_TRACE_SUBMIT, MODEM_TRACE_DELIVERED },
+};
+
+static modem_trace_record_t* get(uint8_t index) {
+  return &ring[(head + index) % MODEM_TRACE_SIZE];
+}
+
+static uint8_t get_bucket(uint32_t duration_us) {
+  uint8_t log2 = 0;
+  while(duration_us >>= 1)
+    log2++;
+
+  if(log2 <= MODEM_TRACE_HISTOGRAM_BASE_LOG2)
+    return 0;
+
+  uint8_t bucket = log2 - MODEM_TRACE_HISTOGRAM_BASE_LOG2;
+  return bucket < MODEM_TRACE_HISTOGRAM_BUCKETS ? bucket : MODEM_TRACE_HISTOGRAM_BUCKETS - 1;
+}
+
+// returns false when the phase was not (completely) reached
+static bool get_duration(const modem_trace_record_t* record, modem_trace_phase_t phase, uint32_t* duration_us) {
+  uint32_t start = record->timestamps[phase_bounds[phase][0]];
+  uint32_t end = record->timestamps[phase_bounds[phase][1]];
+  if(start == 0 || end == 0)
+    return false;
+
+  *duration_us = end - start;
+  return true;
+}
+
+static void add_to_histogram(const modem_trace_record_t* record, modem_trace_phase_t phase) {
+  uint32_t duration;
+  if(!get_duration(record, phase, &duration))
+    return;
+
+  uint16_t* counter = &histograms[record->itf][phase][get_bucket(duration)];
+  if(*counter < UINT16_MAX)
+    (*counter)++;
+}
+
+void modem_trace_complete(const modem_trace_record_t* record) {
+  assert(record->itf < MODEM_TRACE_ITF_COUNT);
+  mutex_lock(&trace_mutex);
+  if(count == MODEM_TRACE_SIZE) {
+    head = (head + 1) % MODEM_TRACE_SIZE; // overwrite the oldest record
+    count--;
+  }
+
+  *get(count) = *record;
+  count++;
+  // the delivery and total are added when delivered
+  for(uint8_t phase = MODEM_TRACE_PHASE_QUEUE; phase < MODEM_TRACE_PHASE_DELIVERY; phase++)
+    add_to_histogram(record, phase);
+
+  mutex_unlock(&trace_mutex);
+}
+
+void modem_trace_delivered(uint8_t tag_id) {
+  uint32_t now = xtimer_now_usec();
+  mutex_lock(&trace_mutex);
+  for(uint8_t i = count; i > 0; i--) {
+    modem_trace_record_t* record = get(i - 1);
+    if(record->tag_id == tag_id && record->completed && record->timestamps[MODEM_TRACE_DELIVERED] == 0) {
+      record->timestamps[MODEM_TRACE_DELIVERED] = now;
+      add_to_histogram(record, MODEM_TRACE_PHASE_DELIVERY);
+      add_to_histogram(record, MODEM_TRACE_PHASE_TOTAL);
+      break;
+    }
+  }
+
+  mutex_unlock(&trace_mutex);
+}
+
+uint8_t modem_get_trace(modem_trace_record_t* records, uint8_t max_records) {
+  mutex_lock(&trace_mutex);
+  uint8_t copied = count < max_records ? count : max_records;
+  for(uint8_t i = 0; i < copied; i++)
+    records[i] = *get(count - copied + i);
+
+  mutex_unlock(&trace_mutex);
+  return copied;
+}
+
+void modem_get_trace_histogram(modem_trace_phase_t phase, modem_trace_itf_t itf, uint16_t* buckets) {
+  assert(phase < MODEM_TRACE_PHASE_COUNT && itf < MODEM_TRACE_ITF_COUNT);
+  mutex_lock(&trace_mutex);
+  memcpy(buckets, histograms[itf][phase], sizeof(histograms[itf][phase]));
+  mutex_unlock(&trace_mutex);
+}
+
+void modem_reset_trace(void) {
+  mutex_lock(&trace_mutex);
+  head = 0;
+  count = 0;
+  memset(histograms, 0, sizeof(histograms));
+  mutex_unlock(&trace_mutex);
+}
+
+static void print_trace(void) {
+  modem_trace_record_t records[MODEM_TRACE_SIZE];
+  uint8_t record_count = modem_get_trace(records, MODEM_TRACE_SIZE);
+  printf("tag itf     result   queue  uart tx   modem  uart rx delivery (us)\n");
+  for(uint8_t i = 0; i < record_count; i++) {
+    modem_trace_record_t* record = &records[i];
+    printf("%3i %-7s %-7s", record->tag_id, itf_names[record->itf],
+           record->cancelled ? "cancel" : (!record->completed ? "timeout" : (record->with_error ? "error" : "ok")));
+    for(uint8_t phase = MODEM_TRACE_PHASE_QUEUE; phase < MODEM_TRACE_PHASE_TOTAL; phase++) {
+      uint32_t duration;
+      if(get_duration(record, phase, &duration))
+        printf(" %8lu", (unsigned long)duration);
+      else
+        printf("        -");
+    }
+
+    printf("\n");
+  }
+}
+
+static void print_histograms(void) {
+  uint16_t buckets[MODEM_TRACE_HISTOGRAM_BUCKETS];
+  printf("bucket upper bounds: %lu us * 2^i\n", (unsigned long)(1UL << (MODEM_TRACE_HISTOGRAM_BASE_LOG2 + 1)));
+  for(uint8_t itf = 0; itf < MODEM_TRACE_ITF_COUNT; itf++) {
+    for(uint8_t phase = 0; phase < MODEM_TRACE_PHASE_COUNT; phase++) {
+      modem_get_trace_histogram(phase, itf, buckets);
+      uint32_t total = 0;
+      for(uint8_t i = 0; i < MODEM_TRACE_HISTOGRAM_BUCKETS; i++)
+        total += buckets[i];
+
+      if(total == 0)
+        continue;
+
+      printf("%-7s %-8s", itf_names[itf], phase_names[phase]);
+      for(uint8_t i = 0; i < MODEM_TRACE_HISTOGRAM_BUCKETS; i++)
+        printf(" %u", buckets[i]);
+
+      printf("\n");
+    }
+  }
+}
+
+int modem_trace_shell_cmd(int argc, char** argv) {
+  if(argc < 2) {
+    print_trace();
+  } else if(strcmp(argv[1], "hist") == 0) {
+    print_histograms();
+  } else if(strcmp(argv[1], "reset") == 0) {
+    modem_reset_trace();
+  } else {
+    printf("usage: %s [hist|reset]\n", argv[0]);
+    return 1;
+  }
+
+  return 0;
+}
+
+#else
+
+uint8_t modem_get_trace(modem_trace_record_t* records, uint8_t max_records) {
+  (void)records;
+  (void)max_records;
+  return 0;
+}
+
+void modem_get_trace_histogram(modem_trace_phase_t phase, modem_trace_itf_t itf, uint16_t* buckets) {
+  (void)phase;
+  (void)itf;
+  memset(buckets, 0, MODEM_TRACE_HISTOGRAM_BUCKETS * sizeof(uint16_t));
+}
+
+void modem_reset_trace(void) {
+}
+
+int modem_trace_shell_cmd(int argc, char** argv) {
+  (void)argc;
+  printf("%s: tracing is disabled, build with CFLAGS += -DMODEM_TRACE\n", argv[0]);
+  return 1;
+}
+
+#endif // MODEM_TRACE
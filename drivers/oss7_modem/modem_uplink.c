@@ -0,0 +1,218 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2018 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include "modem.h"
+#include "modem_uplink.h"
+#include "modem_dispatch.h"
+#include "debug.h"
+#include "mutex.h"
+#include "xtimer.h"
+
+#define DPRINT(...) printf(__VA_ARGS__)
+
+static modem_uplink_t ring[MODEM_UPLINK_QUEUE_SIZE];
+static uint8_t head = 0;
+static uint8_t count = 0;
+static uint32_t next_seqnr = 0;
+static bool in_flight = false;
+static uint32_t in_flight_seqnr;
+static volatile bool backing_off = false;
+
+static session_config_t* uplink_session_config;
+static modem_uplink_drop_policy_t drop_policy;
+static const modem_uplink_storage_t* storage;
+static modem_uplink_stats_t stats;
+static mutex_t uplink_mutex = MUTEX_INIT;
+static xtimer_t retry_timer;
+
+static modem_uplink_t* get(uint8_t index) {
+  return &ring[(head + index) % MODEM_UPLINK_QUEUE_SIZE];
+}
+
+static void persist(modem_uplink_t* uplink) {
+  if(storage)
+    storage->write_slot(uplink - ring, uplink);
+}
+
+static void remove_head(void) {
+  if(storage)
+    storage->write_slot(head, NULL);
+
+  head = (head + 1) % MODEM_UPLINK_QUEUE_SIZE;
+  count--;
+}
+
+static void retry_timeout(void* arg) {
+  (void)arg;
+  backing_off = false;
+  modem_dispatch_wakeup(); // interrupt safe
+}
+
+// restores the queue from storage, the entries are contiguous in the ring, starting at the lowest sequence number
+static void restore(void) {
+  bool valid[MODEM_UPLINK_QUEUE_SIZE];
+  for(uint8_t slot = 0; slot < MODEM_UPLINK_QUEUE_SIZE; slot++) {
+    valid[slot] = storage->read_slot(slot, &ring[slot]);
+    if(!valid[slot])
+      continue;
+
+    if(count == 0 || ring[slot].seqnr < ring[head].seqnr)
+      head = slot;
+
+    if(ring[slot].seqnr >= next_seqnr)
+      next_seqnr = ring[slot].seqnr + 1;
+
+    count++;
+  }
+
+  for(uint8_t i = 0; i < count; i++) {
+    if(!valid[(head + i) % MODEM_UPLINK_QUEUE_SIZE]) {
+      DPRINT("!!! uplink storage corrupt, dropping restored uplinks\n");
+      for(uint8_t slot = 0; slot < MODEM_UPLINK_QUEUE_SIZE; slot++)
+        storage->write_slot(slot, NULL);
+
+      head = 0;
+      count = 0;
+      return;
+    }
+  }
+
+  DPRINT("restored %i uplinks\n", count);
+}
+
+void modem_uplink_init(session_config_t* session_config, modem_uplink_drop_policy_t policy, const modem_uplink_storage_t* uplink_storage) {
+  mutex_lock(&uplink_mutex);
+  uplink_session_config = session_config;
+  drop_policy = policy;
+  storage = uplink_storage;
+  head = 0;
+  count = 0;
+  in_flight = false;
+  memset(&stats, 0, sizeof(stats));
+  retry_timer.callback = &retry_timeout;
+  if(storage)
+    restore();
+
+  stats.queued = count;
+  mutex_unlock(&uplink_mutex);
+  modem_dispatch_wakeup(); // start draining the restored uplinks
+}
+
+bool modem_uplink_push(uint8_t file_id, uint32_t offset, uint8_t length, uint8_t* data) {
+  return modem_uplink_push_prio(file_id, offset, length, data, MODEM_PRIORITY_DEFAULT);
+}
+
+bool modem_uplink_push_prio(uint8_t file_id, uint32_t offset, uint8_t length, uint8_t* data, modem_priority_t priority) {
+  assert(length <= MODEM_UPLINK_MAX_DATA_SIZE);
+  assert(uplink_session_config != NULL); // modem_uplink_init() should be called first
+
+  mutex_lock(&uplink_mutex);
+  modem_uplink_t* uplink = NULL;
+  if(drop_policy == MODEM_UPLINK_COALESCE) {
+    // the new data replaces the data of a queued uplink for the same file (at any offset), which keeps its position
+    for(uint8_t i = 0; i < count; i++) {
+      modem_uplink_t* queued = get(i);
+      bool is_in_flight = in_flight && queued->seqnr == in_flight_seqnr;
+      if(!is_in_flight && queued->file_id == file_id) {
+        uplink = queued;
+        stats.coalesced++;
+        break;
+      }
+    }
+  }
+
+  if(uplink == NULL && count == MODEM_UPLINK_QUEUE_SIZE) {
+    stats.dropped++;
+    if(drop_policy == MODEM_UPLINK_DROP_NEWEST) {
+      mutex_unlock(&uplink_mutex);
+      DPRINT("!!! uplink queue full, dropping newest\n");
+      return false;
+    }
+
+    DPRINT("!!! uplink queue full, dropping oldest\n");
+    remove_head(); // when in flight the uplink is still completed, but not removed a second time
+  }
+
+  if(uplink == NULL) {
+    uplink = get(count);
+    uplink->seqnr = next_seqnr++;
+    count++;
+  }
+
+  uplink->file_id = file_id;
+  uplink->priority = priority;
+  uplink->offset = offset;
+  uplink->length = length;
+  memcpy(uplink->data, data, length);
+  persist(uplink);
+  stats.queued = count;
+  mutex_unlock(&uplink_mutex);
+
+  modem_dispatch_wakeup();
+  return true;
+}
+
+void modem_uplink_get_stats(modem_uplink_stats_t* uplink_stats) {
+  mutex_lock(&uplink_mutex);
+  *uplink_stats = stats;
+  mutex_unlock(&uplink_mutex);
+}
+
+session_config_t* modem_uplink_get_session_config(void) {
+  return uplink_session_config;
+}
+
+bool modem_uplink_take(modem_uplink_t* uplink) {
+  mutex_lock(&uplink_mutex);
+  bool available = count > 0 && !in_flight && !backing_off;
+  if(available) {
+    *uplink = *get(0);
+    in_flight = true;
+    in_flight_seqnr = uplink->seqnr;
+  }
+
+  mutex_unlock(&uplink_mutex);
+  return available;
+}
+
+void modem_uplink_release(void) {
+  mutex_lock(&uplink_mutex);
+  in_flight = false;
+  mutex_unlock(&uplink_mutex);
+}
+
+void modem_uplink_done(bool success) {
+  mutex_lock(&uplink_mutex);
+  in_flight = false;
+  if(success) {
+    stats.sent++;
+    if(count > 0 && get(0)->seqnr == in_flight_seqnr)
+      remove_head(); // might be dropped or coalesced already
+  } else {
+    stats.retries++;
+    backing_off = true;
+    xtimer_set(&retry_timer, MODEM_UPLINK_RETRY_INTERVAL_MS * US_PER_MS);
+  }
+
+  stats.queued = count;
+  mutex_unlock(&uplink_mutex);
+}
@@ -0,0 +1,192 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2018 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stdio.h>
+
+#include "modem.h"
+#include "modem_watchdog.h"
+#include "modem_dispatch.h"
+#include "modem_interface.h"
+#include "debug.h"
+#include "mutex.h"
+#include "xtimer.h"
+
+#define DPRINT(...) printf(__VA_ARGS__)
+
+#define RTT_AVG_WEIGHT 8 // the average RTT weighs a new measurement with 1/RTT_AVG_WEIGHT
+
+static modem_watchdog_health_handler_t health_handler;
+static uint32_t interval_us = 0;
+static uint8_t max_misses;
+static gpio_t reset_pin = GPIO_UNDEF;
+static xtimer_t check_timer;
+static xtimer_t reset_timer;
+
+static volatile bool check_pending = false;
+static volatile bool activity = false;
+static volatile bool ping_outstanding = false;
+static uint32_t ping_sent_timestamp;
+static bool alive = true; // until proven otherwise
+
+static modem_health_t health;
+static mutex_t health_mutex = MUTEX_INIT;
+
+static void check_timeout(void* arg) {
+  (void)arg;
+  check_pending = true;
+  xtimer_set(&check_timer, interval_us);
+  modem_dispatch_wakeup(); // interrupt safe
+}
+
+static void set_alive(bool is_alive) {
+  mutex_lock(&health_mutex);
+  bool changed = alive != is_alive;
+  alive = is_alive;
+  health.alive = is_alive;
+  mutex_unlock(&health_mutex);
+  if(!changed)
+    return;
+
+  DPRINT(is_alive ? "modem alive\n" : "!!! modem not responding\n");
+  if(health_handler)
+    health_handler(is_alive);
+}
+
+static void reset_pulse_end(void* arg) {
+  (void)arg;
+  gpio_set(reset_pin);
+}
+
+static void recover(void) {
+  mutex_lock(&health_mutex);
+  health.recoveries++;
+  mutex_unlock(&health_mutex);
+  modem_reinit();
+  if(reset_pin != GPIO_UNDEF) {
+    // the pulse ends from the timer, sleeping here would block the dispatch worker
+    gpio_clear(reset_pin);
+    xtimer_set(&reset_timer, MODEM_WATCHDOG_RESET_PULSE_MS * US_PER_MS);
+  }
+}
+
+static void check(void) {
+  bool dead = false;
+  mutex_lock(&health_mutex);
+  if(activity) {
+    // no need to ping, the modem is alive
+    activity = false;
+    ping_outstanding = false;
+    health.consecutive_misses = 0;
+    mutex_unlock(&health_mutex);
+    return;
+  }
+
+  if(ping_outstanding) {
+    health.misses++;
+    health.consecutive_misses++;
+    DPRINT("!!! ping not answered (%i)\n", health.consecutive_misses);
+    if(health.consecutive_misses >= max_misses) {
+      health.consecutive_misses = 0; // recover again after the next max_misses missed pings
+      dead = true;
+    }
+  }
+
+  ping_outstanding = true;
+  ping_sent_timestamp = xtimer_now_usec();
+  health.pings++;
+  mutex_unlock(&health_mutex);
+  if(dead) {
+    set_alive(false);
+    recover();
+  }
+
+  modem_send_ping();
+}
+
+void modem_watchdog_init(modem_watchdog_health_handler_t handler) {
+  health_handler = handler;
+  health.alive = true;
+  check_timer.callback = &check_timeout;
+  reset_timer.callback = &reset_pulse_end;
+}
+
+void modem_watchdog_feed(void) {
+  activity = true;
+}
+
+void modem_watchdog_process_ping_response(fifo_t* fifo) {
+  fifo_skip(fifo, fifo_get_size(fifo));
+  mutex_lock(&health_mutex);
+  if(ping_outstanding) {
+    uint32_t rtt = xtimer_now_usec() - ping_sent_timestamp;
+    health.last_rtt_us = rtt;
+    if(rtt > health.max_rtt_us)
+      health.max_rtt_us = rtt;
+
+    if(health.avg_rtt_us == 0)
+      health.avg_rtt_us = rtt;
+    else
+      health.avg_rtt_us = (health.avg_rtt_us * (RTT_AVG_WEIGHT - 1) + rtt) / RTT_AVG_WEIGHT;
+
+    ping_outstanding = false;
+  }
+
+  mutex_unlock(&health_mutex);
+  activity = true;
+  modem_dispatch_wakeup(); // so a dead modem is declared alive again without waiting for the next check
+}
+
+void modem_watchdog_run(void) {
+  if(interval_us == 0)
+    return;
+
+  if(activity && !alive)
+    set_alive(true);
+
+  if(check_pending) {
+    check_pending = false;
+    check();
+  }
+}
+
+void modem_watchdog_start(uint32_t interval_ms, uint8_t misses, gpio_t pin) {
+  assert(interval_ms > 0 && misses > 0);
+  xtimer_remove(&check_timer);
+  interval_us = interval_ms * US_PER_MS;
+  max_misses = misses;
+  reset_pin = pin;
+  if(reset_pin != GPIO_UNDEF) {
+    gpio_init(reset_pin, GPIO_OUT);
+    gpio_set(reset_pin);
+  }
+
+  xtimer_set(&check_timer, interval_us);
+}
+
+void modem_watchdog_stop(void) {
+  xtimer_remove(&check_timer);
+  interval_us = 0;
+  check_pending = false;
+}
+
+void modem_get_health(modem_health_t* modem_health) {
+  mutex_lock(&health_mutex);
+  *modem_health = health;
+  mutex_unlock(&health_mutex);
+}
@@ -0,0 +1,103 @@
+/* * OSS-7 - An opensource implementation of the DASH7 Alliance Protocol for ultra
+ * lowpower wireless sensor communication
+ *
+ * Copyright 2018 University of Antwerp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "sample_codec.h"
+
+// maps signed values to unsigned ones so that small negative differences result in short varints as well
+static uint32_t zigzag_encode(int32_t value) {
+  return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t zigzag_decode(uint32_t value) {
+  return (int32_t)((value >> 1) ^ (0 - (value & 1)));
+}
+
+// returns the number of bytes read, or 0 when the varint is truncated or too long
+static uint8_t decode_varint(const uint8_t* buffer, uint8_t length, uint32_t* value) {
+  *value = 0;
+  for(uint8_t i = 0; i < length && i < SAMPLE_CODEC_VARINT_MAX_SIZE; i++) {
+    *value |= (uint32_t)(buffer[i] & 0x7F) << (7 * i);
+    if(!(buffer[i] & 0x80))
+      return i + 1;
+  }
+
+  return 0;
+}
+
+uint8_t sample_codec_encode_varint(uint8_t* buffer, uint32_t value) {
+  uint8_t length = 0;
+  do {
+    uint8_t b = value & 0x7F;
+    value >>= 7;
+    if(value)
+      b |= 0x80;
+
+    if(buffer)
+      buffer[length] = b;
+
+    length++;
+  } while(value);
+
+  return length;
+}
+
+uint8_t sample_codec_encode_header(uint8_t* buffer, const sample_codec_header_t* header) {
+  buffer[0] = header->version;
+  buffer[1] = header->seqnr;
+  buffer[2] = header->count;
+  return 3 + sample_codec_encode_varint(buffer + 3, header->interval_s);
+}
+
+uint8_t sample_codec_encode_sample(uint8_t* buffer, int32_t previous, int32_t sample) {
+  // calculated modulo 2^32, so the difference of any two samples can be encoded
+  int32_t delta = (int32_t)((uint32_t)sample - (uint32_t)previous);
+  return sample_codec_encode_varint(buffer, zigzag_encode(delta));
+}
+
+int sample_codec_decode(const uint8_t* frame, uint8_t length, sample_codec_header_t* header, int32_t* samples, uint8_t max_samples) {
+  if(length < 4 || frame[0] != SAMPLE_CODEC_VERSION)
+    return -1;
+
+  header->version = frame[0];
+  header->seqnr = frame[1];
+  header->count = frame[2];
+  uint8_t pos = 3;
+  uint8_t varint_length = decode_varint(frame + pos, length - pos, &header->interval_s);
+  if(varint_length == 0)
+    return -1;
+
+  pos += varint_length;
+  int32_t sample = 0;
+  for(uint8_t i = 0; i < header->count; i++) {
+    uint32_t value;
+    varint_length = decode_varint(frame + pos, length - pos, &value);
+    if(varint_length == 0)
+      return -1;
+
+    pos += varint_length;
+    sample = (int32_t)((uint32_t)sample + (uint32_t)zigzag_decode(value));
+    if(i < max_samples)
+      samples[i] = sample;
+  }
+
+  if(pos != length)
+    return -1;
+
+  return header->count;
+}
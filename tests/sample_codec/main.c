@@ -0,0 +1,46 @@
+#include <stdio.h>
+#include <stdint.h>
+
+#include "sample_codec.h"
+
+// round trip of a frame through the encoder and decoder, including the largest deltas
+
+#define MAX_SAMPLES 16
+
+static bool round_trip(const int32_t* samples, uint8_t count, uint32_t interval_s)
+{
+    uint8_t frame[SAMPLE_CODEC_HEADER_MAX_SIZE + MAX_SAMPLES * SAMPLE_CODEC_VARINT_MAX_SIZE];
+    sample_codec_header_t header = { .version = SAMPLE_CODEC_VERSION, .seqnr = 7, .count = count, .interval_s = interval_s };
+    uint8_t length = sample_codec_encode_header(frame, &header);
+    int32_t previous = 0;
+    for(uint8_t i = 0; i < count; i++) {
+        length += sample_codec_encode_sample(frame + length, previous, samples[i]);
+        previous = samples[i];
+    }
+
+    sample_codec_header_t decoded_header;
+    int32_t decoded[MAX_SAMPLES];
+    if(sample_codec_decode(frame, length, &decoded_header, decoded, MAX_SAMPLES) != count
+       || decoded_header.seqnr != header.seqnr || decoded_header.interval_s != interval_s)
+        return false;
+
+    for(uint8_t i = 0; i < count; i++) {
+        if(decoded[i] != samples[i])
+            return false;
+    }
+
+    // a truncated frame is rejected
+    return sample_codec_decode(frame, length - 1, &decoded_header, decoded, MAX_SAMPLES) == -1;
+}
+
+int main(void)
+{
+    static const int32_t regular[] = { 20, 21, 21, 19, 0, -5, 1000000 };
+    static const int32_t extremes[] = { INT32_MAX, INT32_MIN, INT32_MAX, 0, INT32_MIN, -1 }; // deltas overflow int32
+    bool success = round_trip(regular, sizeof(regular) / sizeof(regular[0]), 60)
+        && round_trip(extremes, sizeof(extremes) / sizeof(extremes[0]), 0)
+        && round_trip(extremes, 1, UINT32_MAX);
+
+    puts(success ? "SUCCESS" : "FAILURE");
+    return 0;
+}